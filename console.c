@@ -10,17 +10,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "cpucycles.h"
+#include "perfctr.h"
+#include "replay.h"
 #include "report.h"
 
 /* Some global values */
 int simulation = 0;
 static cmd_ptr cmd_list = NULL;
 static param_ptr param_list = NULL;
+
+/* Hash tables of commands and parameters, indexed by name */
+#define HASH_SIZE 64
+static cmd_ptr cmd_table[HASH_SIZE];
+static param_ptr param_table[HASH_SIZE];
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -32,6 +41,8 @@ static double first_time, last_time;
 
 /* Implement buffered I/O using variant of RIO package from CS:APP
  * Must create stack of buffers to handle I/O with nested source commands.
+ * Regular files are mapped into memory instead, and lines are handed out
+ * directly from the mapping.
  */
 
 #define RIO_BUFSIZE 8192
@@ -42,12 +53,23 @@ struct RIO_ELE {
     int cnt;               /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
+    char *map;             /* Mapped file, or NULL when reading */
+    size_t map_len;        /* Size of mapped file */
+    size_t map_pos;        /* Offset of next unread byte in mapping */
+    replay_t *replay;      /* Compiled trace in mapping, or NULL */
+    cmd_ptr *replay_cmds;  /* Commands of compiled trace, by command ID */
     rio_ptr prev;          /* Next element in stack */
 };
 
 static rio_ptr buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
+/* Arguments of the command line being interpreted.
+ * A line of RIO_BUFSIZE characters cannot hold more words than this.
+ */
+#define MAXARGS (RIO_BUFSIZE / 2)
+static char *argv_buf[MAXARGS];
+
 /* Maximum file descriptor */
 static int fd_max = 0;
 
@@ -60,6 +82,34 @@ static bool quit_flag = false;
 static char *prompt = "cmd> ";
 static bool has_infile = false;
 
+/* File to export command latencies to when quitting */
+static char *stats_file = NULL;
+
+/* File to write event trace to when quitting */
+static char *trace_file = NULL;
+
+/* Report performance counters of every command, not just perf prefixed */
+static int perf_all = 0;
+
+/* Nesting of commands run by other commands, such as repeat */
+static int exec_depth = 0;
+
+/* Lines of loop body, split into arguments when they are collected */
+typedef struct LELE line_ele, *line_ptr;
+struct LELE {
+    cmd_ptr cmd;
+    int argc;
+    char **argv; /* Arguments, stored in same block after this element */
+    size_t size; /* Size of block */
+    line_ptr next;
+};
+
+/* Loop being collected.  Depth counts nested loop ... end pairs */
+static int loop_depth = 0;
+static int loop_reps = 0;
+static line_ptr loop_body = NULL;
+static line_ptr *loop_tail = &loop_body;
+
 /* Optional function to call as part of exit process */
 /* Maximum number of quit functions */
 
@@ -73,6 +123,35 @@ static bool push_file(char *fname);
 static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
+static bool do_perf(int argc, char *argv[]);
+static bool run_line(cmd_ptr cmd, int argc, char *argv[]);
+
+/* FNV-1a hash of name, reduced to table index */
+static unsigned hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char) *name++;
+        h *= 16777619u;
+    }
+    return h & (HASH_SIZE - 1);
+}
+
+static cmd_ptr find_cmd(const char *name)
+{
+    cmd_ptr c = cmd_table[hash_name(name)];
+    while (c && strcmp(name, c->name) != 0)
+        c = c->hnext;
+    return c;
+}
+
+static param_ptr find_param(const char *name)
+{
+    param_ptr p = param_table[hash_name(name)];
+    while (p && strcmp(name, p->name) != 0)
+        p = p->hnext;
+    return p;
+}
 
 /* Add a new command */
 void add_cmd(char *name, cmd_function operation, char *documentation)
@@ -88,8 +167,19 @@ void add_cmd(char *name, cmd_function operation, char *documentation)
     ele->name = name;
     ele->operation = operation;
     ele->documentation = documentation;
+    ele->latency = NULL;
+    ele->trace_id = trace_cmd_id(name);
     ele->next = next_cmd;
     *last_loc = ele;
+
+    unsigned h = hash_name(name);
+    ele->hnext = cmd_table[h];
+    cmd_table[h] = ele;
+}
+
+bool has_cmd(const char *name)
+{
+    return find_cmd(name) != NULL;
 }
 
 /* Add a new parameter */
@@ -112,53 +202,38 @@ void add_param(char *name,
     ele->setter = setter;
     ele->next = next_param;
     *last_loc = ele;
+
+    unsigned h = hash_name(name);
+    ele->hnext = param_table[h];
+    param_table[h] = ele;
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Split a command line into at most maxargs arguments, in place.
+ * White space is replaced with null characters, and argv is filled
+ * with pointers to the start of each word.  Nothing is allocated.
+ * Return number of arguments, or -1 if there are more than maxargs.
+ */
+static int parse_args(char *line, char *argv[], int maxargs)
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
-
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
-
     char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
     int argc = 0;
-    while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
-            }
-            *dst++ = c;
-        }
-    }
+    while (*src != '\0') {
+        while (isspace((unsigned char) *src))
+            src++;
+        if (*src == '\0')
+            break;
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+        /* Hit start of new word */
+        if (argc == maxargs)
+            return -1;
+        argv[argc++] = src;
+        while (*src != '\0' && !isspace((unsigned char) *src))
+            src++;
+        if (*src != '\0')
+            *src++ = '\0';
     }
 
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+    return argc;
 }
 
 static void record_error()
@@ -170,18 +245,36 @@ static void record_error()
     }
 }
 
-/* Execute a command that has already been split into arguments */
-static bool interpret_cmda(int argc, char *argv[])
+/* Execute command next_cmd (NULL when not found) with arguments argv */
+static bool exec_cmd(cmd_ptr next_cmd, int argc, char *argv[])
 {
-    if (argc == 0)
-        return true;
-    /* Try to find matching command */
-    cmd_ptr next_cmd = cmd_list;
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
     if (next_cmd) {
+        uint64_t allocs = 0;
+        bool traced = trace_active;
+        if (traced)
+            trace_begin(&allocs);
+        perfctr_sample_t before, after;
+        bool counted = perf_all && exec_depth == 0 &&
+                       next_cmd->operation != do_perf && perfctr_read(&before);
+        exec_depth++;
+        uint64_t start = latency_now();
+        int64_t cycles = cpucycles();
         ok = next_cmd->operation(argc, argv);
+        cycles = cpucycles() - cycles;
+        uint64_t ns = latency_now() - start;
+        exec_depth--;
+        if (counted && !quit_flag && perfctr_read(&after))
+            perfctr_report(next_cmd->name, &before, &after);
+        /* Command list is gone once quit has run */
+        if (!quit_flag) {
+            if (!next_cmd->latency)
+                next_cmd->latency = latency_new();
+            latency_record(next_cmd->latency, ns, cycles > 0 ? cycles : 0);
+            if (traced)
+                trace_record(next_cmd->trace_id, start, start + ns, allocs,
+                             ok);
+        }
         if (!ok)
             record_error();
     } else {
@@ -193,20 +286,96 @@ static bool interpret_cmda(int argc, char *argv[])
     return ok;
 }
 
+static void free_lines(line_ptr lines)
+{
+    while (lines) {
+        line_ptr ele = lines;
+        lines = lines->next;
+        free_block(ele, ele->size);
+    }
+}
+
+/* Save line into body of loop being collected.
+ * When it ends the loop, run the whole body.
+ */
+static bool collect_line(cmd_ptr cmd, int argc, char *argv[])
+{
+    if (strcmp(argv[0], "loop") == 0)
+        loop_depth++;
+    else if (strcmp(argv[0], "end") == 0)
+        loop_depth--;
+
+    if (loop_depth == 0) {
+        /* Detach body, since it may contain loops of its own */
+        line_ptr body = loop_body;
+        int reps = loop_reps;
+        loop_body = NULL;
+        loop_tail = &loop_body;
+
+        bool ok = true;
+        uint64_t start = latency_now();
+        for (int r = 0; ok && r < reps && !quit_flag; r++) {
+            for (line_ptr l = body; ok && l && !quit_flag; l = l->next)
+                ok = run_line(l->cmd, l->argc, l->argv);
+        }
+        report(2, "Loop of %d iterations: elapsed time = %.3f", reps,
+               (latency_now() - start) * 1.0E-9);
+        free_lines(body);
+        return ok;
+    }
+
+    size_t size = sizeof(line_ele) + argc * sizeof(char *);
+    for (int i = 0; i < argc; i++)
+        size += strlen(argv[i]) + 1;
+    line_ptr ele = malloc_or_fail(size, "collect_line");
+    ele->cmd = cmd;
+    ele->argc = argc;
+    ele->argv = (char **) (ele + 1);
+    ele->size = size;
+    ele->next = NULL;
+    char *dst = (char *) (ele->argv + argc);
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        ele->argv[i] = memcpy(dst, argv[i], len);
+        dst += len;
+    }
+    *loop_tail = ele;
+    loop_tail = &ele->next;
+    return true;
+}
+
+/* Execute line read from input, unless it belongs to a loop body */
+static bool run_line(cmd_ptr cmd, int argc, char *argv[])
+{
+    if (loop_depth > 0)
+        return collect_line(cmd, argc, argv);
+    return exec_cmd(cmd, argc, argv);
+}
+
+/* Execute a command that has already been split into arguments */
+static bool interpret_cmda(int argc, char *argv[])
+{
+    if (argc == 0)
+        return true;
+    /* Try to find matching command */
+    return exec_cmd(find_cmd(argv[0]), argc, argv);
+}
+
 /* Execute a command from a command line */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
         return false;
 
-    int argc;
-    char **argv = parse_args(cmdline, &argc);
-    bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
-    return ok;
+    int argc = parse_args(cmdline, argv_buf, MAXARGS);
+    if (argc < 0) {
+        report(1, "Too many arguments, at most %d allowed", MAXARGS);
+        record_error();
+        return false;
+    }
+    if (argc == 0)
+        return true;
+    return run_line(find_cmd(argv_buf[0]), argc, argv_buf);
 }
 
 /* Set function to be executed as part of program exit */
@@ -224,14 +393,89 @@ void set_echo(bool on)
     echo = on ? 1 : 0;
 }
 
+/* Write latencies of all executed commands as CSV or JSON */
+static bool write_stats(char *fname)
+{
+    FILE *fp = fopen(fname, "w");
+    if (!fp)
+        return false;
+
+    size_t len = strlen(fname);
+    bool csv = len > 4 && strcmp(fname + len - 4, ".csv") == 0;
+    if (csv)
+        fprintf(fp,
+                "command,count,min_ns,p50_ns,p90_ns,p99_ns,max_ns,"
+                "ops_per_sec,cycles_per_op\n");
+    else
+        fprintf(fp, "{\n  \"commands\": [");
+
+    bool first = true;
+    for (cmd_ptr c = cmd_list; c; c = c->next) {
+        latency_t *lat = c->latency;
+        if (!lat)
+            continue;
+        double cycles = (double) lat->total_cycles / lat->count;
+        if (csv) {
+            fprintf(fp,
+                    "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                    ",%" PRIu64 ",%" PRIu64 ",%.1f,%.1f\n",
+                    c->name, lat->count, lat->min_ns,
+                    latency_percentile(lat, 0.5),
+                    latency_percentile(lat, 0.9),
+                    latency_percentile(lat, 0.99), lat->max_ns,
+                    latency_ops(lat), cycles);
+        } else {
+            fprintf(fp,
+                    "%s\n    {\"command\": \"%s\", \"count\": %" PRIu64
+                    ", \"min_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+                    ", \"p90_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+                    ", \"max_ns\": %" PRIu64
+                    ", \"ops_per_sec\": %.1f, \"cycles_per_op\": %.1f}",
+                    first ? "" : ",", c->name, lat->count, lat->min_ns,
+                    latency_percentile(lat, 0.5),
+                    latency_percentile(lat, 0.9),
+                    latency_percentile(lat, 0.99), lat->max_ns,
+                    latency_ops(lat), cycles);
+        }
+        first = false;
+    }
+
+    if (!csv)
+        fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+    return true;
+}
+
 /* Built-in commands */
 static bool do_quit(int argc, char *argv[])
 {
-    cmd_ptr c = cmd_list;
     bool ok = true;
+    if (stats_file) {
+        if (!write_stats(stats_file)) {
+            report(1, "Couldn't write statistics to '%s'", stats_file);
+            ok = false;
+        }
+        free_string(stats_file);
+        stats_file = NULL;
+    }
+
+    if (trace_file) {
+        if (!trace_dump(trace_file)) {
+            report(1, "Couldn't write trace to '%s'", trace_file);
+            ok = false;
+        }
+        free_string(trace_file);
+        trace_file = NULL;
+    }
+    trace_free();
+    perfctr_close();
+
+    cmd_ptr c = cmd_list;
     while (c) {
         cmd_ptr ele = c;
         c = c->next;
+        if (ele->latency)
+            latency_free(ele->latency);
         free_block(ele, sizeof(cmd_ele));
     }
 
@@ -241,10 +485,20 @@ static bool do_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_ele));
     }
+    cmd_list = NULL;
+    param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
 
     while (buf_stack)
         pop_file();
 
+    /* Drop body of unterminated loop */
+    free_lines(loop_body);
+    loop_body = NULL;
+    loop_tail = &loop_body;
+    loop_depth = 0;
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
@@ -313,7 +567,6 @@ static bool do_option(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
@@ -322,23 +575,16 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_ptr plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
-        }
-        /* Didn't find parameter */
-        if (!found) {
+        /* Find parameter in table */
+        param_ptr plist = find_param(name);
+        if (!plist) {
             report(1, "Unknown parameter '%s'", name);
             return false;
         }
+        int oldval = *plist->valp;
+        *plist->valp = value;
+        if (plist->setter)
+            plist->setter(oldval);
     }
 
     return true;
@@ -359,6 +605,56 @@ static bool do_source(int argc, char *argv[])
     return true;
 }
 
+static bool do_compile(int argc, char *argv[])
+{
+    if (argc != 3) {
+        report(1, "%s needs 2 arguments", argv[0]);
+        return false;
+    }
+
+    FILE *fp = fopen(argv[1], "r");
+    if (!fp) {
+        report(1, "Could not open source file '%s'", argv[1]);
+        return false;
+    }
+
+    /* argv lives in argv_buf, so split lines into a separate array */
+    char **words = calloc_or_fail(MAXARGS, sizeof(char *), "do_compile");
+    replay_builder_t *b = replay_begin();
+    char *buf = NULL;
+    size_t size = 0;
+    ssize_t len;
+    bool ok = true;
+    for (int lineno = 1; ok && (len = getline(&buf, &size, fp)) >= 0;
+         lineno++) {
+        if (len > 0 && buf[len - 1] == '\n')
+            buf[len - 1] = '\0';
+        char *line = strsave_or_fail(buf, "do_compile");
+        int cnt = parse_args(buf, words, MAXARGS);
+        if (cnt < 0) {
+            report(1, "Too many arguments on line %d, at most %d allowed",
+                   lineno, MAXARGS);
+            ok = false;
+        } else {
+            replay_add(b, line, cnt, words);
+        }
+        free_string(line);
+    }
+    free(buf);
+    fclose(fp);
+    free_array(words, MAXARGS, sizeof(char *));
+
+    if (!ok) {
+        replay_abort(b);
+        return false;
+    }
+    if (!replay_finish(b, argv[2])) {
+        report(1, "Couldn't write compiled trace '%s'", argv[2]);
+        return false;
+    }
+    return true;
+}
+
 static bool do_log(int argc, char *argv[])
 {
     if (argc < 2) {
@@ -373,6 +669,117 @@ static bool do_log(int argc, char *argv[])
     return result;
 }
 
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    if (argc == 2) {
+        if (stats_file)
+            free_string(stats_file);
+        stats_file = strsave_or_fail(argv[1], "do_stats");
+        return true;
+    }
+
+    report(1, "%-10s %10s %10s %10s %10s %10s %12s %10s", "Command", "Count",
+           "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)", "ops/sec",
+           "cycles/op");
+    for (cmd_ptr c = cmd_list; c; c = c->next) {
+        latency_t *lat = c->latency;
+        if (!lat)
+            continue;
+        report(1,
+               "%-10s %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+               " %10" PRIu64 " %12.1f %10.1f",
+               c->name, lat->count, latency_percentile(lat, 0.5),
+               latency_percentile(lat, 0.9), latency_percentile(lat, 0.99),
+               lat->max_ns, latency_ops(lat),
+               (double) lat->total_cycles / lat->count);
+    }
+    return true;
+}
+
+static bool do_trace(int argc, char *argv[])
+{
+    if (argc >= 2 && argc <= 4 && strcmp(argv[1], "on") == 0) {
+        int nevents = TRACE_EVENTS;
+        if (argc >= 3 && (!get_int(argv[2], &nevents) || nevents <= 0)) {
+            report(1, "Invalid number of events '%s'", argv[2]);
+            return false;
+        }
+        if (argc == 4) {
+            if (trace_file)
+                free_string(trace_file);
+            trace_file = strsave_or_fail(argv[3], "do_trace");
+        }
+        trace_start(nevents);
+        return true;
+    }
+    if (argc == 2 && strcmp(argv[1], "off") == 0) {
+        trace_stop();
+        return true;
+    }
+    if (argc == 3 && strcmp(argv[1], "dump") == 0) {
+        if (!trace_dump(argv[2])) {
+            report(1, "Couldn't write trace to '%s'", argv[2]);
+            return false;
+        }
+        return true;
+    }
+
+    report(1, "%s needs on [n] [file], off, or dump file", argv[0]);
+    return false;
+}
+
+static bool do_repeat(int argc, char *argv[])
+{
+    int reps = 0;
+    if (argc < 3) {
+        report(1, "%s needs a count and a command", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &reps) || reps < 0) {
+        report(1, "Invalid number of repetitions '%s'", argv[1]);
+        return false;
+    }
+
+    /* Look command up once for all repetitions */
+    cmd_ptr cmd = find_cmd(argv[2]);
+    bool ok = true;
+    uint64_t start = latency_now();
+    for (int r = 0; ok && r < reps && !quit_flag; r++)
+        ok = exec_cmd(cmd, argc - 2, argv + 2);
+    report(2, "Repeat of %d iterations: elapsed time = %.3f", reps,
+           (latency_now() - start) * 1.0E-9);
+    return ok;
+}
+
+static bool do_loop(int argc, char *argv[])
+{
+    int reps = 0;
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+    if (!get_int(argv[1], &reps) || reps < 0) {
+        report(1, "Invalid number of iterations '%s'", argv[1]);
+        return false;
+    }
+
+    /* Following lines are collected up to matching end */
+    loop_reps = reps;
+    loop_depth = 1;
+    return true;
+}
+
+static bool do_end(int argc, char *argv[])
+{
+    report(1, "%s without loop", argv[0]);
+    return false;
+}
+
 static bool do_time(int argc, char *argv[])
 {
     double delta = delta_time(&last_time);
@@ -393,11 +800,28 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+static bool do_perf(int argc, char *argv[])
+{
+    if (argc < 2) {
+        report(1, "%s needs a command", argv[0]);
+        return false;
+    }
+
+    perfctr_sample_t before, after;
+    bool counted = perfctr_read(&before);
+    bool ok = interpret_cmda(argc - 1, argv + 1);
+    if (counted && !quit_flag && perfctr_read(&after))
+        perfctr_report(argv[1], &before, &after);
+    return ok;
+}
+
 /* Initialize interpreter */
 void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    memset(cmd_table, 0, sizeof(cmd_table));
+    memset(param_table, 0, sizeof(param_table));
     err_cnt = 0;
     quit_flag = false;
 
@@ -406,12 +830,33 @@ void init_cmd()
     ADD_COMMAND(quit, "                | Exit program");
     ADD_COMMAND(source, " file           | Read commands from source file");
     ADD_COMMAND(log, " file           | Copy output to file");
+    ADD_COMMAND(compile,
+                " src dst        | Compile trace src into binary trace dst, "
+                "which source and -f replay");
     ADD_COMMAND(time, " cmd arg ...    | Time command execution");
+    ADD_COMMAND(perf,
+                " cmd arg ...    | Count cycles, instructions, cache, branch "
+                "and TLB misses of command execution");
+    ADD_COMMAND(repeat, " n cmd arg ...  | Execute command n times");
+    ADD_COMMAND(loop,
+                " n              | Execute following commands up to 'end' n "
+                "times");
+    ADD_COMMAND(end, "                | End body of loop");
+    ADD_COMMAND(stats,
+                " [file]         | Show latency of commands, or export it "
+                "to file (.json or .csv) when quitting");
+    ADD_COMMAND(trace,
+                " on [n] [file]  | Record commands in ring of n events "
+                "(default: n == 65536), and write them to file when "
+                "quitting.  'trace off' stops, 'trace dump file' writes "
+                "them now");
     add_cmd("#", do_comment_cmd, " ...            | Display comment");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
+    add_param("perf", &perf_all,
+              "Count cycles, instructions and misses of every command", NULL);
 
     init_in();
     init_time(&last_time);
@@ -436,9 +881,44 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->cnt = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+    rnew->map_len = 0;
+    rnew->map_pos = 0;
+    rnew->replay = NULL;
+    rnew->replay_cmds = NULL;
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
+    /* Map regular files.  The mapping is private and writable, so that
+     * lines can be terminated in place.  Pipes and terminals are read.
+     */
+    struct stat st;
+    if (fname && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+        st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            rnew->map = map;
+            rnew->map_len = st.st_size;
+        }
+    }
+
+    if (rnew->map && replay_is_compiled(rnew->map, rnew->map_len)) {
+        rnew->replay = malloc_or_fail(sizeof(replay_t), "push_file");
+        if (!replay_open(rnew->replay, rnew->map, rnew->map_len)) {
+            report(1, "Malformed compiled trace '%s'", fname);
+            pop_file();
+            return false;
+        }
+        /* Resolve command IDs once */
+        uint32_t ncmds = rnew->replay->ncmds;
+        rnew->replay_cmds =
+            calloc_or_fail(ncmds + 1, sizeof(cmd_ptr), "push_file");
+        for (uint32_t i = 0; i < ncmds; i++)
+            rnew->replay_cmds[i] =
+                find_cmd(replay_cmd_name(rnew->replay, i));
+    }
+
     return true;
 }
 
@@ -448,6 +928,14 @@ static void pop_file()
     if (buf_stack) {
         rio_ptr rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->replay) {
+            if (rsave->replay_cmds)
+                free_array(rsave->replay_cmds, rsave->replay->ncmds + 1,
+                           sizeof(cmd_ptr));
+            free_block(rsave->replay, sizeof(replay_t));
+        }
+        if (rsave->map)
+            munmap(rsave->map, rsave->map_len);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -459,19 +947,57 @@ static void init_in()
     buf_stack = NULL;
 }
 
-/* Read command from input file.
- * When hit EOF, close that file and return NULL
- */
-static char *readline()
+/* Is there unread input in the buffer of current file? */
+static bool buf_pending()
 {
-    int cnt;
-    char c;
-    char *lptr = linebuf;
-
     if (!buf_stack)
+        return false;
+    /* Compiled trace is popped when replay runs past its end */
+    if (buf_stack->replay)
+        return true;
+    if (buf_stack->map)
+        return buf_stack->map_pos < buf_stack->map_len;
+    return buf_stack->cnt > 0;
+}
+
+/* Return next line of mapped file, terminated in place */
+static char *readline_map()
+{
+    rio_ptr rp = buf_stack;
+    if (rp->map_pos >= rp->map_len) {
+        /* Encountered EOF */
+        pop_file();
         return NULL;
+    }
+
+    char *line = rp->map + rp->map_pos;
+    size_t left = rp->map_len - rp->map_pos;
+    char *end = memchr(line, '\n', left);
+    if (end) {
+        *end = '\0';
+        rp->map_pos += end - line + 1;
+        return line;
+    }
+
+    /* Last line of file did not terminate with newline.
+     * There may be no room behind it in the mapping, so copy it.
+     */
+    if (left > RIO_BUFSIZE - 1)
+        left = RIO_BUFSIZE - 1;
+    memcpy(linebuf, line, left);
+    linebuf[left] = '\0';
+    rp->map_pos = rp->map_len;
+    return linebuf;
+}
 
-    for (cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
+/* Return next line of file read through internal buffer, copied to linebuf
+ */
+static char *readline_buf()
+{
+    size_t cnt = 0;
+    bool eol = false;
+
+    while (!eol && cnt < RIO_BUFSIZE - 1) {
         if (buf_stack->cnt <= 0) {
             /* Need to read from input file */
             buf_stack->cnt = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
@@ -479,41 +1005,76 @@ static char *readline()
             if (buf_stack->cnt <= 0) {
                 /* Encountered EOF */
                 pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
-                return NULL;
+                if (cnt == 0)
+                    return NULL;
+                /* Last line of file did not terminate with newline. */
+                break;
             }
         }
 
-        /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->cnt--;
-        if (c == '\n')
-            break;
+        /* Have text in buffer.  Take up to newline, or as much as fits */
+        size_t n = buf_stack->cnt;
+        if (n > RIO_BUFSIZE - 1 - cnt)
+            n = RIO_BUFSIZE - 1 - cnt;
+        char *nl = memchr(buf_stack->bufptr, '\n', n);
+        if (nl) {
+            n = nl - buf_stack->bufptr + 1;
+            eol = true;
+        }
+        memcpy(linebuf + cnt, buf_stack->bufptr, n);
+        buf_stack->bufptr += n;
+        buf_stack->cnt -= n;
+        cnt += n;
     }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
-        *lptr++ = '\n';
+    /* Drop newline.  A line hitting the buffer limit is cut short. */
+    if (eol)
+        cnt--;
+    linebuf[cnt] = '\0';
+    return linebuf;
+}
+
+/* Read command from input file.
+ * When hit EOF, close that file and return NULL
+ */
+static char *readline()
+{
+    if (!buf_stack)
+        return NULL;
+
+    char *line = buf_stack->map ? readline_map() : readline_buf();
+    if (line && echo) {
+        report_noreturn(1, prompt);
+        report(1, "%s", line);
+    }
+
+    return line;
+}
+
+/* Execute next line of compiled trace.
+ * When hit end of trace, close that file
+ */
+static void replay_line()
+{
+    rio_ptr rp = buf_stack;
+    char *line;
+    uint32_t cmd;
+    int argc;
+    if (!replay_next(rp->replay, &line, &cmd, &argc, argv_buf, MAXARGS)) {
+        if (rp->replay->rec != rp->replay->rec_end)
+            report(1, "Malformed record in compiled trace");
+        pop_file();
+        return;
     }
-    *lptr++ = '\0';
 
     if (echo) {
         report_noreturn(1, prompt);
-        report_noreturn(1, linebuf);
+        report(1, "%s", line);
     }
 
-    return linebuf;
+    if (quit_flag || argc == 0)
+        return;
+    run_line(rp->replay_cmds[cmd], argc, argv_buf);
 }
 
 static bool cmd_done()
@@ -542,6 +1103,18 @@ int cmd_select(int nfds,
     if (cmd_done())
         return 0;
 
+    if (!block_flag && has_infile && buf_pending()) {
+        /* Command already in internal buffer.  No need to wait for it */
+        if (buf_stack->replay) {
+            replay_line();
+        } else {
+            char *cmdline = readline();
+            if (cmdline)
+                interpret_cmd(cmdline);
+        }
+        return 0;
+    }
+
     if (!block_flag) {
         /* Process any commands in input buffer */
         if (!readfds)
@@ -552,7 +1125,7 @@ int cmd_select(int nfds,
         FD_SET(infd, readfds);
         if (infd == STDIN_FILENO && prompt_flag) {
             printf("%s", prompt);
-            fflush(stdout);
+            report_flush();
             prompt_flag = true;
         }
 
@@ -640,14 +1213,17 @@ bool run_console(char *infile_name)
 
     if (!has_infile) {
         char *cmdline;
+        report_flush();
         while ((cmdline = linenoise(prompt)) != NULL) {
-            interpret_cmd(cmdline);
+            /* Save before interpreting, which splits the line in place */
             linenoiseHistoryAdd(cmdline);       /* Add to the history. */
             linenoiseHistorySave(HISTORY_FILE); /* Save the history on disk. */
+            interpret_cmd(cmdline);
             linenoiseFree(cmdline);
             while (buf_stack && buf_stack->fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
             has_infile = false;
+            report_flush();
         }
     } else {
         while (!cmd_done())
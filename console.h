@@ -3,7 +3,9 @@
 
 #include <stdbool.h>
 #include <sys/select.h>
+#include "latency.h"
 #include "linenoise.h"
+#include "trace.h"
 #define HISTORY_FILE ".cmd_history"
 
 /* Implementation of simple command-line interface */
@@ -16,13 +18,20 @@ typedef bool (*cmd_function)(int argc, char *argv[]);
 
 /* Information about each command */
 
-/* Organized as linked list in alphabetical order */
+/* Organized as linked list in alphabetical order,
+ * and chained into hash table for lookup by name
+ */
 typedef struct CELE cmd_ele, *cmd_ptr;
 struct CELE {
     char *name;
     cmd_function operation;
     char *documentation;
+    /* Durations of command execution, allocated on first use */
+    latency_t *latency;
+    /* ID of command in event traces */
+    uint16_t trace_id;
     cmd_ptr next;
+    cmd_ptr hnext;
 };
 
 /* Optionally supply function that gets invoked when parameter changes */
@@ -37,6 +46,7 @@ struct PELE {
     /* Function that gets called whenever parameter changes */
     setter_function setter;
     param_ptr next;
+    param_ptr hnext;
 };
 
 /* Initialize interpreter */
@@ -46,6 +56,9 @@ void init_cmd();
 void add_cmd(char *name, cmd_function operation, char *documentation);
 #define ADD_COMMAND(cmd, msg) add_cmd(#cmd, do_##cmd, msg)
 
+/* Is there a command called name? */
+bool has_cmd(const char *name);
+
 /* Add a new parameter */
 void add_param(char *name,
                int *valp,
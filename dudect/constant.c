@@ -1,12 +1,11 @@
 #include "constant.h"
-#include <assert.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include "cpucycles.h"
+#include "timer.h"
 #include "queue.h"
 #include "random.h"
 
@@ -20,25 +19,13 @@ const size_t n_measure = N_MEASURE;
 
 const int drop_size = 20;
 
-/* Maintain a queue independent from the qtest since
- * we do not want the test to affect the original functionality
- */
-static struct list_head *l = NULL;
-
 static char random_string[N_MEASURE][8];
 static int random_string_iter = 0;
 
-enum {
-    test_insert_head,
-    test_insert_tail,
-    test_remove_head,
-    test_remove_tail,
-};
-
 /* Implement the necessary queue interface to simulation */
 void init_dut(void)
 {
-    l = NULL;
+    random_string_iter = 0;
 }
 
 char *get_random_string(void)
@@ -63,79 +50,86 @@ void prepare_inputs(uint8_t *input_data, uint8_t *classes)
     }
 }
 
+/* Build a queue independent from the qtest, since we do not want the
+ * test to affect the original functionality.  Class 0 inputs are all
+ * zero and leave it empty.
+ */
+static void dut_setup(dut_ctx_t *ctx, const uint8_t *input)
+{
+    ctx->l = q_new();
+    ctx->s = get_random_string();
+    ctx->e = NULL;
+    for (int j = *(uint16_t *) input % 10000; j > 0; j--)
+        q_insert_head(ctx->l, get_random_string());
+}
+
+static void dut_teardown(dut_ctx_t *ctx)
+{
+    if (ctx->e)
+        q_release_element(ctx->e);
+    q_free(ctx->l);
+}
+
+static void measure_insert_head(dut_ctx_t *ctx)
+{
+    q_insert_head(ctx->l, ctx->s);
+}
+
+static void measure_insert_tail(dut_ctx_t *ctx)
+{
+    q_insert_tail(ctx->l, ctx->s);
+}
+
+static void measure_remove_head(dut_ctx_t *ctx)
+{
+    ctx->e = q_remove_head(ctx->l, NULL, 0);
+}
+
+static void measure_remove_tail(dut_ctx_t *ctx)
+{
+    ctx->e = q_remove_tail(ctx->l, NULL, 0);
+}
+
+static void measure_size(dut_ctx_t *ctx)
+{
+    q_size(ctx->l);
+}
+
+const dut_t dut_table[] = {
+    {"insert_head", "ih", NULL, dut_setup, measure_insert_head, dut_teardown},
+    {"insert_tail", "it", NULL, dut_setup, measure_insert_tail, dut_teardown},
+/* FIXME: It is known that both q_remove_head() and q_remove_tail() can
+ * not pass dudect on Arm64. We shall figure out the exact reasons and
+ * resolve later.
+ */
+#if !defined(__aarch64__)
+    {"remove_head", "rh", NULL, dut_setup, measure_remove_head, dut_teardown},
+    {"remove_tail", "rt", NULL, dut_setup, measure_remove_tail, dut_teardown},
+#endif
+    {"size", "size", NULL, dut_setup, measure_size, dut_teardown},
+    {NULL},
+};
+
+const dut_t *dut_find(const char *cmd)
+{
+    for (const dut_t *op = dut_table; op->name; op++) {
+        if (strcmp(op->cmd, cmd) == 0)
+            return op;
+    }
+    return NULL;
+}
+
 void measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
-             int mode)
+             const dut_t *op)
 {
-    assert(mode == test_insert_head || mode == test_insert_tail ||
-           mode == test_remove_head || mode == test_remove_tail);
-
-    switch (mode) {
-    case test_insert_head:
-        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
-        break;
-    case test_insert_tail:
-        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
-            char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
-        break;
-    case test_remove_head:
-        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_head(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            if (e)
-                q_release_element(e);
-            dut_free();
-        }
-        break;
-    case test_remove_tail:
-        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            element_t *e = q_remove_tail(l, NULL, 0);
-            after_ticks[i] = cpucycles();
-            if (e)
-                q_release_element(e);
-            dut_free();
-        }
-        break;
-    default:
-        for (size_t i = drop_size; i < n_measure - drop_size; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * chunk_size) % 10000);
-            before_ticks[i] = cpucycles();
-            dut_size(1);
-            after_ticks[i] = cpucycles();
-            dut_free();
-        }
+    dut_ctx_t ctx;
+    for (size_t i = drop_size; i < n_measure - drop_size; i++) {
+        op->setup(&ctx, input_data + i * chunk_size);
+        before_ticks[i] = timer_begin();
+        op->measure(&ctx);
+        after_ticks[i] = timer_end();
+        op->teardown(&ctx);
     }
 }
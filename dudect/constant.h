@@ -2,35 +2,40 @@
 #define DUDECT_CONSTANT_H
 
 #include <stdint.h>
-#define dut_new() ((void) (l = q_new()))
+#include "queue.h"
 
-#define dut_size(n)                                \
-    do {                                           \
-        for (int __iter = 0; __iter < n; ++__iter) \
-            q_size(l);                             \
-    } while (0)
+/* State shared by the callbacks of one measurement */
+typedef struct {
+    struct list_head *l; /* Queue built by setup */
+    char *s;             /* String to insert */
+    element_t *e;        /* Element removed by the measured operation */
+} dut_ctx_t;
 
-#define dut_insert_head(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_head(l, s); \
-    } while (0)
+/* Operation whose execution time is tested by dudect.  For each input
+ * chunk, setup builds the queue outside of the measurement, measure runs
+ * the operation between the cycle counter reads, and teardown releases
+ * whatever the other two left behind.
+ */
+typedef struct {
+    char *name; /* Shown while testing */
+    char *cmd;  /* qtest command running the test in simulation mode */
+    /* Generate inputs and their classes, prepare_inputs when NULL */
+    void (*prepare)(uint8_t *input_data, uint8_t *classes);
+    void (*setup)(dut_ctx_t *ctx, const uint8_t *input);
+    void (*measure)(dut_ctx_t *ctx);
+    void (*teardown)(dut_ctx_t *ctx);
+} dut_t;
 
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
+/* Registered operations, terminated by an entry with NULL name */
+extern const dut_t dut_table[];
 
-#define dut_free() ((void) (q_free(l)))
+const dut_t *dut_find(const char *cmd);
 
 void init_dut();
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 void measure(int64_t *before_ticks,
              int64_t *after_ticks,
              uint8_t *input_data,
-             int mode);
+             const dut_t *op);
 
 #endif
@@ -1,3 +1,6 @@
+#ifndef DUDECT_CPUCYCLES_H
+#define DUDECT_CPUCYCLES_H
+
 #include <stdint.h>
 // http://www.intel.com/content/www/us/en/embedded/training/ia-32-ia-64-benchmark-code-execution-paper.html
 static inline int64_t cpucycles(void)
@@ -21,3 +24,5 @@ static inline int64_t cpucycles(void)
 #error Unsupported Architecture
 #endif
 }
+
+#endif
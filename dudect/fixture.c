@@ -24,28 +24,49 @@
  *
  *  - as long as any of the different test fails, the code will be deemed
  *    variable time.
+ *
+ *  - measurements may be spread over worker processes pinned to separate
+ *    CPUs. Each collects its own statistics, which are merged afterwards.
+ *    The test harness is not thread-safe, hence processes, not threads.
  */
 
+#define _GNU_SOURCE /* sched_setaffinity */
 #include "fixture.h"
 #include <assert.h>
 #include <math.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "../console.h"
 #include "../random.h"
 #include "constant.h"
+#include "timer.h"
 #include "ttest.h"
 
 #define enough_measure 10000
 #define test_tries 10
 
+/* Sequential verdicts wait for this many measurements */
+#define min_measure (enough_measure / 10)
+
+/* Margin on t for sequential verdicts, in standard deviations */
+#define z_margin 3
+
 extern const int drop_size;
 extern const size_t chunk_size;
 extern const size_t n_measure;
 static t_ctx *t;
 
+/* Number of measurement workers, one per available CPU when 0 */
+int dudect_workers = 0;
+
+/* Stop measuring as soon as the verdict is clear */
+int dudect_sequential = 1;
+
 /* threshold values for Welch's t-test */
 enum {
     t_threshold_bananas = 500, /* Test failed with overwhelming probability */
@@ -61,8 +82,15 @@ static void differentiate(int64_t *exec_times,
                           const int64_t *before_ticks,
                           const int64_t *after_ticks)
 {
-    for (size_t i = 0; i < n_measure; i++)
-        exec_times[i] = after_ticks[i] - before_ticks[i];
+    for (size_t i = 0; i < n_measure; i++) {
+        int64_t ticks = after_ticks[i] - before_ticks[i];
+        /* Only counter wraps and dropped measurements may end up <= 0.
+         * Runs faster than the timer overhead are kept, as 1.
+         */
+        if (ticks > 0)
+            ticks = ticks > timer_overhead + 1 ? ticks - timer_overhead : 1;
+        exec_times[i] = ticks;
+    }
 }
 
 static void update_statistics(const int64_t *exec_times, uint8_t *classes)
@@ -117,7 +145,7 @@ static bool report(void)
     return true;
 }
 
-static bool doit(int mode)
+static void doit(const dut_t *op)
 {
     int64_t *before_ticks = calloc(n_measure + 1, sizeof(int64_t));
     int64_t *after_ticks = calloc(n_measure + 1, sizeof(int64_t));
@@ -130,20 +158,205 @@ static bool doit(int mode)
         die();
     }
 
-    prepare_inputs(input_data, classes);
+    if (op->prepare)
+        op->prepare(input_data, classes);
+    else
+        prepare_inputs(input_data, classes);
 
-    measure(before_ticks, after_ticks, input_data, mode);
+    measure(before_ticks, after_ticks, input_data, op);
     differentiate(exec_times, before_ticks, after_ticks);
     update_statistics(exec_times, classes);
-    bool ret = report();
 
     free(before_ticks);
     free(after_ticks);
     free(exec_times);
     free(classes);
     free(input_data);
+}
+
+/* Measure one batch in this process, kept on its current CPU meanwhile
+ * so that cycle counters are comparable.  The affinity set is restored
+ * afterwards, unless it is NULL for unknown.
+ */
+static void doit_here(const dut_t *op, const cpu_set_t *set)
+{
+    if (set) {
+        cpu_set_t here;
+        CPU_ZERO(&here);
+        CPU_SET(sched_getcpu(), &here);
+        sched_setaffinity(0, sizeof(here), &here);
+    }
+    doit(op);
+    if (set)
+        sched_setaffinity(0, sizeof(*set), set);
+}
+
+/* Pin calling process to the k-th CPU of set */
+static void pin_cpu(const cpu_set_t *set, int k)
+{
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set) && k-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            sched_setaffinity(0, sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+/* Run given number of rounds of measurements in a worker process pinned
+ * to the k-th CPU of set, with inputs drawn from seed.  Return pid of
+ * worker, whose statistics can be read from *fdp, or -1 when no worker
+ * could be started.
+ */
+static pid_t start_worker(const dut_t *op,
+                          int rounds,
+                          const cpu_set_t *set,
+                          int k,
+                          uint64_t seed,
+                          int *fdp)
+{
+    int fd[2];
+    if (pipe(fd) < 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        pin_cpu(set, k);
+        /* Inputs must differ from those of the other workers */
+        random_seed(seed);
+        /* Counters opened by the parent do not count this process */
+        timer_init();
+        t_init(t);
+        for (int i = 0; i < rounds; i++)
+            doit(op);
+        ssize_t n = write(fd[1], t, sizeof(t_ctx));
+        _exit(n == sizeof(t_ctx) ? 0 : 1);
+    }
+
+    close(fd[1]);
+    *fdp = fd[0];
+    return pid;
+}
+
+/* Collect statistics of worker into t.  Return false if it failed */
+static bool finish_worker(pid_t pid, int fd)
+{
+    t_ctx part;
+    size_t got = 0;
+    while (got < sizeof(part)) {
+        ssize_t n = read(fd, (char *) &part + got, sizeof(part) - got);
+        if (n <= 0)
+            break;
+        got += n;
+    }
+    close(fd);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || got != sizeof(part))
+        return false;
+
+    t_merge(t, &part);
+    return true;
+}
 
-    return ret;
+/* Run rounds of measurements, split over given number of workers */
+static void measure_parallel(const dut_t *op,
+                             int rounds,
+                             int workers,
+                             const cpu_set_t *set)
+{
+    pid_t *pids = calloc(workers, sizeof(pid_t));
+    int *fds = calloc(workers, sizeof(int));
+    if (!pids || !fds)
+        die();
+
+    /* Output buffered before fork, including the log file, would be
+     * written by every worker
+     */
+    fflush(NULL);
+    for (int w = 0; w < workers; w++) {
+        int share = rounds / workers + (w < rounds % workers);
+        pids[w] = start_worker(op, share, set, w % CPU_COUNT(set),
+                               random_u64(), &fds[w]);
+    }
+
+    /* Make up for workers that could not run, in this process */
+    for (int w = 0; w < workers; w++) {
+        if (pids[w] < 0 || !finish_worker(pids[w], fds[w])) {
+            int share = rounds / workers + (w < rounds % workers);
+            for (int i = 0; i < share; i++)
+                doit_here(op, set);
+        }
+    }
+    free(pids);
+    free(fds);
+}
+
+/* Sequential verdict on the measurements so far: 1 when the largest t
+ * stays below the threshold even if it grew with the square root of the
+ * measurements still to go, -1 when it is beyond doubt above it, 0 when
+ * undecided.  A single interrupted measurement can push t well past the
+ * moderate threshold for a while, so only the overwhelming one fails
+ * early.
+ */
+static int sequential_verdict(void)
+{
+    double n = t->n[0] + t->n[1];
+    if (n < min_measure)
+        return 0;
+
+    double max_t = fabs(t_compute(t));
+    if (max_t - z_margin > t_threshold_bananas)
+        return -1;
+    if (n < enough_measure &&
+        (max_t + z_margin) * sqrt(enough_measure / n) < t_threshold_moderate)
+        return 1;
+    return 0;
+}
+
+/* Run rounds of measurements, split over one worker per CPU of set,
+ * stopping early in sequential mode once the verdict is clear.  Without
+ * a known set, all rounds run in this process.
+ */
+static bool measure_rounds(const dut_t *op, int rounds, const cpu_set_t *set)
+{
+    int workers = dudect_workers;
+    if (!set)
+        workers = 1;
+    else if (workers <= 0)
+        workers = CPU_COUNT(set);
+    if (workers > rounds)
+        workers = rounds;
+
+    bool result = false;
+    for (int done = 0; done < rounds;) {
+        /* Each worker measures one batch between verdicts */
+        int chunk = dudect_sequential ? workers : rounds;
+        if (chunk > rounds - done)
+            chunk = rounds - done;
+        if (workers <= 1 || chunk == 1)
+            doit_here(op, set);
+        else
+            measure_parallel(op, chunk, workers, set);
+        done += workers <= 1 ? 1 : chunk;
+
+        result = report();
+        int verdict = dudect_sequential ? sequential_verdict() : 0;
+        if (verdict) {
+            result = verdict > 0;
+            break;
+        }
+    }
+    return result;
 }
 
 static void init_once(void)
@@ -152,41 +365,40 @@ static void init_once(void)
     t_init(t);
 }
 
-static bool TEST_CONST(char *text, int mode)
+static bool TEST_CONST(const dut_t *op)
 {
     bool result = false;
+    double used = 0;
+    int cnt;
     t = malloc(sizeof(t_ctx));
+    if (!t)
+        die();
 
-    for (int cnt = 0; cnt < test_tries; ++cnt) {
-        printf("Testing %s...(%d/%d)\n\n", text, cnt, test_tries);
+    /* CPUs to spread workers over, taken before anything is pinned */
+    cpu_set_t saved;
+    const cpu_set_t *set =
+        sched_getaffinity(0, sizeof(saved), &saved) == 0 ? &saved : NULL;
+    timer_init();
+
+    for (cnt = 0; cnt < test_tries; ++cnt) {
+        printf("Testing %s...(%d/%d)\n\n", op->name, cnt, test_tries);
         init_once();
-        for (int i = 0; i < enough_measure / (n_measure - drop_size * 2) + 1;
-             ++i)
-            result = doit(mode);
+        result = measure_rounds(
+            op, enough_measure / (n_measure - drop_size * 2) + 1, set);
         printf("\033[A\033[2K\033[A\033[2K");
+        used += t->n[0] + t->n[1];
         if (result == true)
             break;
     }
+    printf("%s: %.0f measurements in %d tries, %s timer\n", op->name, used,
+           cnt < test_tries ? cnt + 1 : test_tries, timer_name());
+    timer_close();
     free(t);
     return result;
 }
 
-bool is_insert_head_const(void)
-{
-    return TEST_CONST("insert_head", 0);
-}
-
-bool is_insert_tail_const(void)
-{
-    return TEST_CONST("insert_tail", 1);
-}
-
-bool is_remove_head_const(void)
-{
-    return TEST_CONST("remove_head", 2);
-}
-
-bool is_remove_tail_const(void)
+bool is_const(const char *cmd)
 {
-    return TEST_CONST("remove_tail", 3);
+    const dut_t *op = dut_find(cmd);
+    return op && TEST_CONST(op);
 }
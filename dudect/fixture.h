@@ -4,10 +4,13 @@
 #include <stdbool.h>
 #include "constant.h"
 
-/* Interface to test if function is constant */
-bool is_insert_head_const(void);
-bool is_insert_tail_const(void);
-bool is_remove_head_const(void);
-bool is_remove_tail_const(void);
+/* Number of measurement workers, one per available CPU when 0 */
+extern int dudect_workers;
+
+/* Stop measuring once the verdict is clear when set */
+extern int dudect_sequential;
+
+/* Interface to test if operation registered as command cmd is constant */
+bool is_const(const char *cmd);
 
 #endif
@@ -0,0 +1,108 @@
+#include "timer.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Number of empty measurements taken to calibrate overhead */
+#define CALIBRATE_RUNS 1000
+
+int dudect_timer = timer_auto;
+int timer_backend = timer_rdtsc;
+int64_t timer_overhead = 0;
+
+#if defined(__linux__)
+struct perf_event_mmap_page *timer_page = NULL;
+static int perf_fd = -1;
+#endif
+
+static const char *timer_names[] = {
+    "auto", "rdtsc", "rdtscp+lfence", "perf rdpmc", "clock_gettime",
+};
+
+const char *timer_name(void)
+{
+    return timer_names[timer_backend];
+}
+
+void timer_close(void)
+{
+#if defined(__linux__)
+    if (timer_page)
+        munmap(timer_page, sysconf(_SC_PAGESIZE));
+    if (perf_fd >= 0)
+        close(perf_fd);
+    timer_page = NULL;
+    perf_fd = -1;
+#endif
+    timer_backend = timer_rdtsc;
+}
+
+/* Open a core cycle counter of the calling process, readable in user
+ * space.  Virtual machines and perf_event_paranoid often forbid it.
+ */
+static bool perf_open(void)
+{
+#ifdef TIMER_HAVE_PERF
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (perf_fd < 0)
+        return false;
+
+    timer_page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED,
+                      perf_fd, 0);
+    if (timer_page == MAP_FAILED) {
+        timer_page = NULL;
+        timer_close();
+        return false;
+    }
+    if (!timer_page->cap_user_rdpmc || !timer_page->index) {
+        timer_close();
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void calibrate(void)
+{
+    int64_t best = INT64_MAX;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        int64_t before = timer_begin();
+        int64_t after = timer_end();
+        if (after - before < best)
+            best = after - before;
+    }
+    timer_overhead = best > 0 ? best : 0;
+}
+
+void timer_init(void)
+{
+    timer_close();
+    int want = dudect_timer;
+    if (want <= timer_auto || want >= n_timers)
+        want = timer_auto;
+
+    if ((want == timer_auto || want == timer_perf) && perf_open())
+        timer_backend = timer_perf;
+#ifdef TIMER_HAVE_FENCES
+    else if (want == timer_auto || want == timer_perf || want == timer_fenced)
+        timer_backend = timer_fenced;
+#endif
+    else if (want == timer_rdtsc)
+        timer_backend = timer_rdtsc;
+    else
+        timer_backend = timer_clock;
+
+    calibrate();
+}
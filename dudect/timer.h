@@ -0,0 +1,135 @@
+#ifndef DUDECT_TIMER_H
+#define DUDECT_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "cpucycles.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#endif
+
+/* Timing backends for dudect measurements, set with option dudect_timer */
+enum {
+    timer_auto,    /* First available of perf, fenced and clock */
+    timer_rdtsc,   /* Bare cycle counter read, as cpucycles() */
+    timer_fenced,  /* rdtscp and lfence around the measured region */
+    timer_perf,    /* Core cycles, read in user space with rdpmc */
+    timer_clock,   /* clock_gettime, in nanoseconds */
+    n_timers,
+};
+
+/* Requested backend, timer_auto by default */
+extern int dudect_timer;
+
+/* Backend in use since timer_init, and its cost of an empty measurement */
+extern int timer_backend;
+extern int64_t timer_overhead;
+
+#if defined(__linux__)
+extern struct perf_event_mmap_page *timer_page;
+#endif
+
+/* Select backend for calling process, falling back when the requested
+ * one is not available, and calibrate its overhead.
+ */
+void timer_init(void);
+void timer_close(void);
+const char *timer_name(void);
+
+static inline int64_t timer_clock_read(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TIMER_HAVE_FENCES 1
+
+/* Keep earlier instructions from leaking into the measured region */
+static inline int64_t timer_fenced_begin(void)
+{
+    unsigned int hi, lo;
+    __asm__ volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi)::"memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+}
+
+/* Wait for the measured region to finish, and keep later instructions
+ * from starting before the counter is read.
+ */
+static inline int64_t timer_fenced_end(void)
+{
+    unsigned int hi, lo, aux;
+    __asm__ volatile("rdtscp\n\tlfence"
+                     : "=a"(lo), "=d"(hi), "=c"(aux)::"memory");
+    return ((int64_t) lo) | (((int64_t) hi) << 32);
+}
+
+#if defined(__linux__)
+#define TIMER_HAVE_PERF 1
+
+/* Read the cycle counter of the perf event without a system call,
+ * following the protocol of struct perf_event_mmap_page.
+ */
+static inline int64_t timer_perf_read(void)
+{
+    struct perf_event_mmap_page *pc = timer_page;
+    uint32_t seq;
+    int64_t count;
+    do {
+        seq = pc->lock;
+        __asm__ volatile("" ::: "memory");
+        uint32_t idx = pc->index;
+        count = pc->offset;
+        if (pc->cap_user_rdpmc && idx) {
+            unsigned int hi, lo;
+            __asm__ volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+            int shift = 64 - pc->pmc_width;
+            count += (int64_t) ((((uint64_t) hi << 32) | lo) << shift) >> shift;
+        }
+        __asm__ volatile("" ::: "memory");
+    } while (pc->lock != seq);
+    return count;
+}
+#endif
+#endif
+
+static inline int64_t timer_begin(void)
+{
+    switch (timer_backend) {
+#ifdef TIMER_HAVE_FENCES
+    case timer_fenced:
+        return timer_fenced_begin();
+#endif
+#ifdef TIMER_HAVE_PERF
+    case timer_perf:
+        return timer_perf_read();
+#endif
+    case timer_clock:
+        return timer_clock_read();
+    default:
+        return cpucycles();
+    }
+}
+
+static inline int64_t timer_end(void)
+{
+    switch (timer_backend) {
+#ifdef TIMER_HAVE_FENCES
+    case timer_fenced:
+        return timer_fenced_end();
+#endif
+#ifdef TIMER_HAVE_PERF
+    case timer_perf:
+        return timer_perf_read();
+#endif
+    case timer_clock:
+        return timer_clock_read();
+    default:
+        return cpucycles();
+    }
+}
+
+#endif
@@ -39,6 +39,23 @@ double t_compute(t_ctx *ctx)
     return t_value;
 }
 
+/* Merge statistics of src into dst, with the parallel algorithm of Chan
+ * et al. for combining variances.
+ */
+void t_merge(t_ctx *dst, const t_ctx *src)
+{
+    for (int class = 0; class < 2; class ++) {
+        double n = dst->n[class] + src->n[class];
+        if (n == 0)
+            continue;
+        double delta = src->mean[class] - dst->mean[class];
+        dst->mean[class] += delta * src->n[class] / n;
+        dst->m2[class] += src->m2[class] +
+                          delta * delta * dst->n[class] * src->n[class] / n;
+        dst->n[class] = n;
+    }
+}
+
 void t_init(t_ctx *ctx)
 {
     for (int class = 0; class < 2; class ++) {
@@ -2,9 +2,13 @@
 
 #include <setjmp.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -43,9 +47,45 @@ typedef struct BELE {
 static block_ele_t *allocated = NULL;
 static size_t allocated_count = 0;
 
+/* Regions holding many blocks, released when the last one is freed.
+ * Bulk regions are carved into ordinary blocks with headers and footers.
+ * Foreign regions hold blocks without any, such as strings in a mapped
+ * file.  One bit per byte of the region marks where live blocks start,
+ * so that frees of anything else are caught.
+ */
+typedef struct REGION {
+    char *start, *end;
+    char *next_free; /* Bulk regions: where the next block is carved */
+    uint8_t *starts; /* Foreign regions: bits set where live blocks start */
+    size_t live;
+    bool foreign;
+    void (*release)(void *start, size_t len);
+    struct REGION *next;
+} region_t;
+
+static region_t *regions = NULL;
+
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Fault injection schedule */
+int fail_seed = 0;
+int fail_every = 0;
+int fail_nth = 0;
+
+/* Is any fault injection mode enabled? */
+static bool fault_armed = false;
+/* Generator state, seeded from fail_seed */
+static uint64_t fault_state = 0;
+/* Generator output below this value fails the allocation */
+static uint64_t fault_threshold = 0;
+/* Allocations seen since the schedule was armed */
+static size_t fault_count = 0;
+/* Only fail allocations made by this function */
+#define MAX_SITE 64
+static char fault_site_buf[MAX_SITE];
+static char *fault_site = NULL;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
@@ -53,6 +93,23 @@ static char *error_message = "";
 
 static int time_limit = 1;
 
+/* Time budget of risky operations in microseconds (0 = use time_limit) */
+int time_budget_us = 0;
+
+/* Extra budget granted per element, in nanoseconds */
+int time_budget_elem_ns = 0;
+
+/* Number of elements the next budget is scaled by */
+static size_t budget_elements = 0;
+
+/* Budget of current risky operation and when it started */
+static long budget_ns = 0;
+static struct timespec budget_start;
+
+/* POSIX timer on CLOCK_MONOTONIC delivering SIGALRM */
+static timer_t budget_timer;
+static bool budget_timer_ready = false;
+
 /* Data for managing exceptions */
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
@@ -60,11 +117,34 @@ static bool time_limited = false;
 
 /* Internal functions */
 
-/* Should this allocation fail? */
-static bool fail_allocation()
+/* SplitMix64: fast, and any seed (including 0) is fine */
+static uint64_t fault_next()
 {
-    double weight = (double) random() / RAND_MAX;
-    return (weight < 0.01 * fail_probability);
+    uint64_t z = (fault_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Should this allocation fail?
+ * Only called when some fault injection mode is armed.
+ */
+static bool fail_allocation(const char *site)
+{
+    if (fault_site && (!site || strcmp(site, fault_site) != 0))
+        return false;
+
+    fault_count++;
+    if (fail_nth > 0 && fault_count == (size_t) fail_nth)
+        return true;
+    if (fail_every > 0 && fault_count % fail_every == 0)
+        return true;
+    if (fault_threshold && (fault_next() >> 32) < fault_threshold)
+        return true;
+
+    /* Call site given without any other mode: fail all of its allocations */
+    return fault_site && fail_nth <= 0 && fail_every <= 0 &&
+           fail_probability <= 0;
 }
 
 /* Find header of block, given its payload.
@@ -113,16 +193,61 @@ static size_t *find_footer(block_ele_t *b)
     return p;
 }
 
+/* Region holding p, or NULL */
+static region_t *find_region(void *p)
+{
+    for (region_t *r = regions; r; r = r->next) {
+        if ((char *) p >= r->start && (char *) p < r->end)
+            return r;
+    }
+    return NULL;
+}
+
+static void release_region(region_t *r)
+{
+    region_t **loc = &regions;
+    while (*loc != r)
+        loc = &(*loc)->next;
+    *loc = r->next;
+    if (r->release)
+        r->release(r->start, r->end - r->start);
+    else
+        free(r->start);
+    free(r->starts);
+    free(r);
+}
+
+/* Link block holding size bytes into list of allocated blocks */
+static void *link_block(block_ele_t *new_block, size_t size)
+{
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->magic_header = MAGICHEADER;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->payload_size = size;
+    *find_footer(new_block) = MAGICFOOTER;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->next = allocated;
+    // cppcheck-suppress nullPointerRedundantCheck
+    new_block->prev = NULL;
+
+    if (allocated)
+        allocated->prev = new_block;
+    allocated = new_block;
+    allocated_count++;
+
+    return (void *) &new_block->payload;
+}
+
 /* Implementation of application functions */
 
-void *test_malloc(size_t size)
+void *test_malloc_site(size_t size, const char *site)
 {
     if (noallocate_mode) {
         report_event(MSG_FATAL, "Calls to malloc disallowed");
         return NULL;
     }
 
-    if (fail_allocation()) {
+    if (fault_armed && fail_allocation(site)) {
         report_event(MSG_WARN, "Malloc returning NULL");
         return NULL;
     }
@@ -134,26 +259,16 @@ void *test_malloc(size_t size)
         error_occurred = true;
     }
 
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->magic_header = MAGICHEADER;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->payload_size = size;
-    *find_footer(new_block) = MAGICFOOTER;
-    void *p = (void *) &new_block->payload;
+    void *p = link_block(new_block, size);
     memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
-
     return p;
 }
 
+void *test_malloc(size_t size)
+{
+    return test_malloc_site(size, NULL);
+}
+
 // cppcheck-suppress unusedFunction
 void *test_calloc(size_t nelem, size_t elsize)
 {
@@ -176,6 +291,24 @@ void test_free(void *p)
     if (!p)
         return;
 
+    region_t *r = regions ? find_region(p) : NULL;
+    if (r && r->foreign) {
+        size_t off = (char *) p - r->start;
+        uint8_t bit = 1 << (off % 8);
+        if (!(r->starts[off / 8] & bit)) {
+            report_event(MSG_ERROR,
+                         "Attempted to free unallocated block.  Address = %p",
+                         p);
+            error_occurred = true;
+            return;
+        }
+        r->starts[off / 8] &= ~bit;
+        allocated_count--;
+        if (--r->live == 0)
+            release_region(r);
+        return;
+    }
+
     block_ele_t *b = find_header(p);
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
@@ -199,34 +332,241 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
-    free(b);
+    if (!r)
+        free(b);
+    else if (--r->live == 0)
+        release_region(r);
     allocated_count--;
 }
 
-// cppcheck-suppress unusedFunction
-char *test_strdup(const char *s)
+char *test_strdup_site(const char *s, const char *site)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    void *new = test_malloc_site(len, site);
     if (!new)
         return NULL;
 
     return memcpy(new, s, len);
 }
 
+// cppcheck-suppress unusedFunction
+char *test_strdup(const char *s)
+{
+    return test_strdup_site(s, NULL);
+}
+
 size_t allocation_check()
 {
     return allocated_count;
 }
 
+/* Space taken by block of size bytes, keeping the next one aligned */
+#define BULK_ALIGN 16
+static size_t bulk_block_size(size_t size)
+{
+    size_t bytes = sizeof(block_ele_t) + size + sizeof(size_t);
+    return (bytes + BULK_ALIGN - 1) & ~(size_t) (BULK_ALIGN - 1);
+}
+
+static void madvise_huge(char *start, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *from = (char *) (((uintptr_t) start + page - 1) & ~(page - 1));
+    char *to = (char *) (((uintptr_t) start + len) & ~(page - 1));
+    if (to > from)
+        madvise(from, to - from, MADV_HUGEPAGE);
+#endif
+}
+
+void *test_bulk_new(size_t nblocks, size_t payload_bytes)
+{
+    if (noallocate_mode) {
+        report_event(MSG_FATAL, "Calls to malloc disallowed");
+        return NULL;
+    }
+
+    /* Each block needs at most BULK_ALIGN - 1 bytes of padding */
+    size_t len = nblocks * bulk_block_size(0) + payload_bytes +
+                 nblocks * (BULK_ALIGN - 1);
+    region_t *r = malloc(sizeof(region_t));
+    char *start = malloc(len);
+    if (!r || !start) {
+        free(r);
+        free(start);
+        return NULL;
+    }
+    /* Fewer page faults while the region is filled, where supported */
+    madvise_huge(start, len);
+    r->start = r->next_free = start;
+    r->end = start + len;
+    r->starts = NULL;
+    r->live = 0;
+    r->foreign = false;
+    r->release = NULL;
+    r->next = regions;
+    regions = r;
+    return r;
+}
+
+void *test_bulk_alloc(void *region, size_t size)
+{
+    region_t *r = region;
+    size_t bytes = bulk_block_size(size);
+    if (r->next_free + bytes > r->end)
+        return NULL;
+
+    block_ele_t *b = (block_ele_t *) r->next_free;
+    r->next_free += bytes;
+    r->live++;
+    return link_block(b, size);
+}
+
+void test_bulk_done(void *region)
+{
+    region_t *r = region;
+    if (r->live == 0)
+        release_region(r);
+}
+
+void *test_foreign_new(void *start,
+                       size_t len,
+                       void (*release)(void *start, size_t len))
+{
+    region_t *r = malloc(sizeof(region_t));
+    uint8_t *starts = calloc(len / 8 + 1, 1);
+    if (!r || !starts) {
+        free(r);
+        free(starts);
+        return NULL;
+    }
+    r->start = r->next_free = start;
+    r->end = (char *) start + len;
+    r->starts = starts;
+    r->live = 0;
+    r->foreign = true;
+    r->release = release;
+    r->next = regions;
+    regions = r;
+    return r;
+}
+
+void test_foreign_block(void *region, void *p)
+{
+    region_t *r = region;
+    size_t off = (char *) p - r->start;
+    r->starts[off / 8] |= 1 << (off % 8);
+    r->live++;
+    allocated_count++;
+}
+
+/* Arm (ns > 0) or disarm (ns == 0) the time limit.
+ * Fall back to setitimer when no POSIX timer can be created.  Nothing is
+ * armed when QTEST_NO_TIMER is set, as under valgrind, which slows every
+ * operation far beyond its budget.
+ */
+static void set_timer(long ns)
+{
+    static int no_timer = -1;
+    if (no_timer < 0)
+        no_timer = getenv("QTEST_NO_TIMER") != NULL;
+    if (no_timer)
+        return;
+
+    if (!budget_timer_ready) {
+        struct sigevent sev = {
+            .sigev_notify = SIGEV_SIGNAL,
+            .sigev_signo = SIGALRM,
+        };
+        budget_timer_ready =
+            timer_create(CLOCK_MONOTONIC, &sev, &budget_timer) == 0;
+    }
+
+    if (budget_timer_ready) {
+        struct itimerspec its = {
+            .it_value = {.tv_sec = ns / 1000000000L,
+                         .tv_nsec = ns % 1000000000L},
+        };
+        timer_settime(budget_timer, 0, &its, NULL);
+    } else {
+        /* Round up, so that a short budget is not turned into no limit */
+        long us = (ns + 999) / 1000;
+        struct itimerval itv = {
+            .it_value = {.tv_sec = us / 1000000L, .tv_usec = us % 1000000L},
+        };
+        setitimer(ITIMER_REAL, &itv, NULL);
+    }
+}
+
+/* Microseconds since the current risky operation started */
+static long budget_elapsed_us()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - budget_start.tv_sec) * 1000000L +
+           (now.tv_nsec - budget_start.tv_nsec) / 1000L;
+}
+
 /* Implementation of functions for testing */
 
+/* Scale the time budget of the next risky operation by n elements */
+void set_budget_elements(size_t n)
+{
+    budget_elements = n;
+}
+
+/* Restrict malloc failures to allocations made by function site */
+void set_fault_site(const char *site)
+{
+    if (site) {
+        strncpy(fault_site_buf, site, MAX_SITE - 1);
+        fault_site_buf[MAX_SITE - 1] = '\0';
+        fault_site = fault_site_buf;
+    } else {
+        fault_site = NULL;
+    }
+    fault_reset();
+}
+
+/* Rearm fault injection after any of its parameters changed */
+void fault_reset()
+{
+    fault_count = 0;
+    if (fail_probability <= 0)
+        fault_threshold = 0;
+    else if (fail_probability >= 100)
+        fault_threshold = UINT64_MAX;
+    else
+        fault_threshold = ((uint64_t) fail_probability << 32) / 100;
+    fault_armed =
+        fault_threshold || fail_every > 0 || fail_nth > 0 || fault_site;
+    if (!fault_armed)
+        return;
+
+    if (fail_seed) {
+        fault_state = (uint64_t) fail_seed;
+    } else {
+        /* Pick a seed, and tell how to replay this run */
+        int seed = (int) ((time(NULL) ^ getpid()) & 0x7fffffff);
+        if (!seed)
+            seed = 1;
+        fault_state = (uint64_t) seed;
+        report(2,
+               "Fault injection seed = %d (replay with 'option malloc_seed "
+               "%d')",
+               seed, seed);
+    }
+}
+
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * Return the previous mode.
  */
-void set_cautious_mode(bool cautious)
+bool set_cautious_mode(bool cautious)
 {
+    bool was = cautious_mode;
     cautious_mode = cautious;
+    return was;
 }
 
 /* Set/unset restricted allocation mode.
@@ -254,9 +594,10 @@ bool exception_setup(bool limit_time)
         /* Got here from longjmp */
         jmp_ready = false;
         if (time_limited) {
-            alarm(0);
+            set_timer(0);
             time_limited = false;
         }
+        budget_elements = 0;
 
         if (error_message)
             report_event(MSG_ERROR, error_message);
@@ -267,7 +608,13 @@ bool exception_setup(bool limit_time)
     /* Got here from initial call */
     jmp_ready = true;
     if (limit_time) {
-        alarm(time_limit);
+        if (time_budget_us > 0)
+            budget_ns = time_budget_us * 1000L +
+                        (long) budget_elements * time_budget_elem_ns;
+        else
+            budget_ns = time_limit * 1000000000L;
+        clock_gettime(CLOCK_MONOTONIC, &budget_start);
+        set_timer(budget_ns);
         time_limited = true;
     }
     return true;
@@ -277,9 +624,13 @@ bool exception_setup(bool limit_time)
 void exception_cancel()
 {
     if (time_limited) {
-        alarm(0);
+        set_timer(0);
         time_limited = false;
+        if (time_budget_us > 0)
+            report(2, "Elapsed time = %ld us, budget = %ld us",
+                   budget_elapsed_us(), budget_ns / 1000);
     }
+    budget_elements = 0;
 
     jmp_ready = false;
     error_message = "";
@@ -16,19 +16,68 @@ void test_free(void *p);
 char *test_strdup(const char *s);
 /* FIXME: provide test_realloc as well */
 
+/* Same as test_malloc and test_strdup, but tagged with the name of the
+ * calling function so that fault injection can target a single call site.
+ */
+void *test_malloc_site(size_t size, const char *site);
+char *test_strdup_site(const char *s, const char *site);
+
 #ifdef INTERNAL
 
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Allocate many blocks from one region, for building large queues quickly.
+ * test_bulk_new reserves room for nblocks blocks holding payload_bytes in
+ * total, and test_bulk_alloc carves blocks from it, returning NULL once it
+ * is exhausted.  Their contents are not initialized.  Blocks are freed
+ * one by one with test_free, and the region goes with the last of them.
+ * Call test_bulk_done after the last test_bulk_alloc.
+ */
+void *test_bulk_new(size_t nblocks, size_t payload_bytes);
+void *test_bulk_alloc(void *region, size_t size);
+void test_bulk_done(void *region);
+
+/* Let test_free accept blocks in [start, start + len) that were not
+ * allocated by the harness, such as strings in a mapped file.
+ * test_foreign_new returns the region, or NULL when out of memory, and
+ * test_foreign_block declares a block starting at p.  Frees of anything
+ * else in the region are reported.  release(start, len) is called once
+ * all blocks are freed, so at least one must be declared.
+ */
+void *test_foreign_new(void *start,
+                       size_t len,
+                       void (*release)(void *start, size_t len));
+void test_foreign_block(void *region, void *p);
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Seed of malloc failure generator (0 = pick one and report it) */
+extern int fail_seed;
+
+/* Fail every Nth allocation (0 = disabled) */
+extern int fail_every;
+
+/* Fail the Kth allocation only (0 = disabled) */
+extern int fail_nth;
+
+/* Restrict malloc failures to allocations made by function site.
+ * NULL removes the restriction.
+ */
+void set_fault_site(const char *site);
+
+/* Rearm fault injection after any of its parameters changed.
+ * Resets the allocation count and reseeds the generator.
+ */
+void fault_reset();
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
+ * Return the previous mode.
  */
-void set_cautious_mode(bool cautious);
+bool set_cautious_mode(bool cautious);
 
 /*
  * Set/unset restricted allocation mode.
@@ -39,6 +88,15 @@ void set_noallocate_mode(bool noallocate);
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
+/* Time budget of risky operations in microseconds (0 = one second) */
+extern int time_budget_us;
+
+/* Extra time budget granted per element, in nanoseconds */
+extern int time_budget_elem_ns;
+
+/* Scale the time budget of the next risky operation by n elements */
+void set_budget_elements(size_t n);
+
 /* Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
  */
@@ -54,12 +112,12 @@ void trigger_exception(char *msg);
 #else /* !INTERNAL */
 
 /* Tested program use our versions of malloc and free */
-#define malloc test_malloc
+#define malloc(size) test_malloc_site(size, __func__)
 #define free test_free
 
 /* Use undef to avoid strdup redefined error */
 #undef strdup
-#define strdup test_strdup
+#define strdup(s) test_strdup_site(s, __func__)
 
 #endif
 
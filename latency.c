@@ -0,0 +1,91 @@
+/* Latency histograms of console commands */
+
+#include "latency.h"
+
+#include <stdint.h>
+#include <time.h>
+
+#include "report.h"
+
+uint64_t latency_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+latency_t *latency_new()
+{
+    latency_t *lat = calloc_or_fail(1, sizeof(latency_t), "latency_new");
+    lat->min_ns = UINT64_MAX;
+    return lat;
+}
+
+void latency_free(latency_t *lat)
+{
+    free_array(lat, 1, sizeof(latency_t));
+}
+
+/* Values below LAT_SUB are exact.  Above that, the bucket is given by the
+ * position of the most significant bit and the LAT_SUB_BITS bits below it.
+ */
+static int bucket_of(uint64_t v)
+{
+    if (v < LAT_SUB)
+        return (int) v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - LAT_SUB_BITS;
+    int sub = (int) (v >> shift) & (LAT_SUB - 1);
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB + sub;
+}
+
+/* Midpoint of the values falling into bucket idx */
+static uint64_t value_of(int idx)
+{
+    if (idx < 2 * LAT_SUB)
+        return (uint64_t) idx;
+    int shift = idx / LAT_SUB - 1;
+    uint64_t low = (uint64_t) (LAT_SUB + idx % LAT_SUB) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+void latency_record(latency_t *lat, uint64_t ns, uint64_t cycles)
+{
+    lat->count++;
+    lat->total_ns += ns;
+    lat->total_cycles += cycles;
+    if (ns < lat->min_ns)
+        lat->min_ns = ns;
+    if (ns > lat->max_ns)
+        lat->max_ns = ns;
+    lat->buckets[bucket_of(ns)]++;
+}
+
+uint64_t latency_percentile(const latency_t *lat, double p)
+{
+    if (!lat->count)
+        return 0;
+
+    uint64_t rank = (uint64_t) (p * lat->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += lat->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = value_of(i);
+            /* Never report beyond what was actually observed */
+            if (v > lat->max_ns)
+                return lat->max_ns;
+            return v < lat->min_ns ? lat->min_ns : v;
+        }
+    }
+    return lat->max_ns;
+}
+
+double latency_ops(const latency_t *lat)
+{
+    if (!lat->total_ns)
+        return 0.0;
+    return lat->count * 1.0E9 / lat->total_ns;
+}
@@ -0,0 +1,44 @@
+#ifndef LAB0_LATENCY_H
+#define LAB0_LATENCY_H
+
+#include <stdint.h>
+
+/* Latency histograms of console commands.
+ *
+ * Durations are kept in log-linear buckets (in the manner of HdrHistogram):
+ * every power of two is split into LAT_SUB sub-buckets, so any recorded
+ * value is known within 1/LAT_SUB of its magnitude while the histogram
+ * keeps a fixed size.
+ */
+
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t total_cycles;
+    uint64_t min_ns, max_ns;
+    uint64_t buckets[LAT_BUCKETS];
+} latency_t;
+
+/* Current time of monotonic clock in nanoseconds */
+uint64_t latency_now();
+
+/* Allocate empty histogram */
+latency_t *latency_new();
+
+/* Free histogram */
+void latency_free(latency_t *lat);
+
+/* Record one duration */
+void latency_record(latency_t *lat, uint64_t ns, uint64_t cycles);
+
+/* Duration below which fraction p (0.0 - 1.0) of recorded ones fall */
+uint64_t latency_percentile(const latency_t *lat, double p);
+
+/* Operations per second over the recorded durations */
+double latency_ops(const latency_t *lat);
+
+#endif /* LAB0_LATENCY_H */
@@ -0,0 +1,171 @@
+/* Hardware performance counters of console commands */
+
+#include "perfctr.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "report.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#define PERFCTR_HAVE_PERF 1
+#endif
+
+static const char *event_names[PERFCTR_EVENTS] = {
+    "cycles",        "instructions", "L1D misses",
+    "LLC misses",    "branch misses", "dTLB misses",
+};
+
+/* File descriptor of each counter, the cycle counter leading the group */
+static int fds[PERFCTR_EVENTS] = {-1, -1, -1, -1, -1, -1};
+
+/* Position of each counter in group reads, -1 when not counted */
+static int slots[PERFCTR_EVENTS];
+static int nslots = 0;
+
+static bool tried = false;
+
+#ifdef PERFCTR_HAVE_PERF
+static int open_event(int event, int group_fd)
+{
+    static const struct {
+        uint32_t type;
+        uint64_t config;
+    } events[PERFCTR_EVENTS] = {
+        [PERFCTR_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        [PERFCTR_INSTRUCTIONS] = {PERF_TYPE_HARDWARE,
+                                  PERF_COUNT_HW_INSTRUCTIONS},
+        [PERFCTR_L1D_MISSES] = {PERF_TYPE_HW_CACHE,
+                                PERF_COUNT_HW_CACHE_L1D |
+                                    PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                    PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+        [PERFCTR_LLC_MISSES] = {PERF_TYPE_HARDWARE,
+                                PERF_COUNT_HW_CACHE_MISSES},
+        [PERFCTR_BRANCH_MISSES] = {PERF_TYPE_HARDWARE,
+                                   PERF_COUNT_HW_BRANCH_MISSES},
+        [PERFCTR_DTLB_MISSES] = {PERF_TYPE_HW_CACHE,
+                                 PERF_COUNT_HW_CACHE_DTLB |
+                                     PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[event].type;
+    attr.config = events[event].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+/* Open group of counters.  Return false if the cycle counter, which
+ * leads it, cannot be opened.
+ */
+static bool perfctr_open()
+{
+    tried = true;
+    nslots = 0;
+    for (int i = 0; i < PERFCTR_EVENTS; i++)
+        slots[i] = -1;
+
+#ifdef PERFCTR_HAVE_PERF
+    fds[PERFCTR_CYCLES] = open_event(PERFCTR_CYCLES, -1);
+    if (fds[PERFCTR_CYCLES] < 0) {
+        report(1, "Performance counters are not available: %s",
+               strerror(errno));
+        return false;
+    }
+    slots[PERFCTR_CYCLES] = nslots++;
+
+    for (int i = 0; i < PERFCTR_EVENTS; i++) {
+        if (i == PERFCTR_CYCLES)
+            continue;
+        fds[i] = open_event(i, fds[PERFCTR_CYCLES]);
+        if (fds[i] >= 0)
+            slots[i] = nslots++;
+    }
+    return true;
+#else
+    report(1, "Performance counters are not supported on this system");
+    return false;
+#endif
+}
+
+bool perfctr_read(perfctr_sample_t *s)
+{
+    if (!tried)
+        perfctr_open();
+    if (fds[PERFCTR_CYCLES] < 0)
+        return false;
+
+    /* Number of counters, times enabled and running, then the values */
+    uint64_t buf[3 + PERFCTR_EVENTS];
+    ssize_t len = (3 + nslots) * sizeof(uint64_t);
+    if (read(fds[PERFCTR_CYCLES], buf, len) != len)
+        return false;
+
+    s->enabled_ns = buf[1];
+    s->running_ns = buf[2];
+    for (int i = 0; i < PERFCTR_EVENTS; i++)
+        s->value[i] = slots[i] < 0 ? 0 : buf[3 + slots[i]];
+    return true;
+}
+
+void perfctr_report(const char *name,
+                    const perfctr_sample_t *before,
+                    const perfctr_sample_t *after)
+{
+    /* Scale up counts when the kernel multiplexed the group */
+    uint64_t enabled = after->enabled_ns - before->enabled_ns;
+    uint64_t running = after->running_ns - before->running_ns;
+    if (!running) {
+        report(1, "%s: not counted, the kernel never scheduled the counters",
+               name);
+        return;
+    }
+    double scale = running && running < enabled ? (double) enabled / running
+                                                : 1.0;
+
+    uint64_t count[PERFCTR_EVENTS];
+    for (int i = 0; i < PERFCTR_EVENTS; i++)
+        count[i] = (after->value[i] - before->value[i]) * scale;
+
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s:", name);
+    for (int i = 0; i < PERFCTR_EVENTS && len < sizeof(line); i++) {
+        const char *sep = i ? "," : "";
+        if (slots[i] < 0)
+            len += snprintf(line + len, sizeof(line) - len, "%s n/a %s", sep,
+                            event_names[i]);
+        else
+            len += snprintf(line + len, sizeof(line) - len, "%s %" PRIu64 " %s",
+                            sep, count[i], event_names[i]);
+        if (i == PERFCTR_INSTRUCTIONS && slots[i] >= 0 &&
+            count[PERFCTR_CYCLES] && len < sizeof(line))
+            len += snprintf(line + len, sizeof(line) - len, " (%.2f IPC)",
+                            (double) count[i] / count[PERFCTR_CYCLES]);
+    }
+    if (scale > 1.0 && len < sizeof(line))
+        snprintf(line + len, sizeof(line) - len, " (scaled, counted %.0f%%)",
+                 100.0 / scale);
+    report(1, "%s", line);
+}
+
+void perfctr_close()
+{
+    for (int i = 0; i < PERFCTR_EVENTS; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+    tried = false;
+}
@@ -0,0 +1,45 @@
+#ifndef LAB0_PERFCTR_H
+#define LAB0_PERFCTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Hardware performance counters of console commands.
+ *
+ * The counters are opened once, as a single perf_event_open group led by
+ * the cycle counter, so that all of them count over the same intervals.
+ * Counters the CPU or kernel does not offer are left out of the group.
+ * When even the cycle counter cannot be opened, as in most virtual
+ * machines or with a strict perf_event_paranoid, nothing is counted.
+ */
+
+enum {
+    PERFCTR_CYCLES,
+    PERFCTR_INSTRUCTIONS,
+    PERFCTR_L1D_MISSES,
+    PERFCTR_LLC_MISSES,
+    PERFCTR_BRANCH_MISSES,
+    PERFCTR_DTLB_MISSES,
+    PERFCTR_EVENTS,
+};
+
+/* Counter values at one point in time */
+typedef struct {
+    uint64_t value[PERFCTR_EVENTS];
+    uint64_t enabled_ns, running_ns;
+} perfctr_sample_t;
+
+/* Read all counters, opening them on first use.
+ * Return false if counters are not available.
+ */
+bool perfctr_read(perfctr_sample_t *s);
+
+/* Report counts between two samples for command name */
+void perfctr_report(const char *name,
+                    const perfctr_sample_t *before,
+                    const perfctr_sample_t *after);
+
+/* Close counters */
+void perfctr_close();
+
+#endif /* LAB0_PERFCTR_H */
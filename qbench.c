@@ -0,0 +1,428 @@
+/* Microbenchmark of queue operations, independent of qtest.
+ *
+ * Every operation of queue.h is timed over queues of growing size, built
+ * from strings of different length distributions in different orders.
+ * Results are written as JSON, one result per line, and can be compared
+ * against a baseline written by an earlier run.
+ */
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "queue.h"
+
+#ifdef BENCH_HARNESS
+/* Queue code allocates through the test harness */
+#define INTERNAL 1
+#include "harness.h"
+#endif
+
+#define MIN_SIZE 100
+#define MAX_SIZE 10000000
+
+/* Spend at least this much time per measurement on small queues */
+#define MIN_WORK 100000
+
+/* Length distributions of strings, [min, max) */
+typedef struct {
+    char *name;
+    int min, max;
+} length_dist_t;
+
+static const length_dist_t lengths[] = {
+    {"short", 5, 10},
+    {"long", 64, 128},
+    {"mixed", 1, 256},
+};
+
+enum { ORDER_RANDOM, ORDER_SORTED, ORDER_REVERSED, ORDER_EQUAL, N_ORDERS };
+static char *order_names[N_ORDERS] = {"random", "sorted", "reversed", "equal"};
+
+typedef struct {
+    char *name;
+    /* Time of running operation on queue q of n elements, in ns */
+    uint64_t (*run)(struct list_head *q, size_t n, char **strs);
+    /* Does cost depend on input order, and on string length? */
+    bool by_order, by_length;
+    /* Is the queue built before the measurement? */
+    bool prefill;
+} bench_op_t;
+
+/* One result, either measured or read from baseline */
+typedef struct {
+    char op[16], order[16], length[16];
+    long size;
+    int reps;
+    double min_ns, median_ns, ns_per_elem;
+} result_t;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* SplitMix64, with fixed seed so that every run sees the same strings */
+static uint64_t rng_state = 0x5eed;
+static uint64_t rng_next()
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t run_ih(struct list_head *q, size_t n, char **strs)
+{
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        q_insert_head(q, strs[i]);
+    return now_ns() - start;
+}
+
+static uint64_t run_it(struct list_head *q, size_t n, char **strs)
+{
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        q_insert_tail(q, strs[i]);
+    return now_ns() - start;
+}
+
+static uint64_t run_rh(struct list_head *q, size_t n, char **strs)
+{
+    char buf[256];
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        q_release_element(q_remove_head(q, buf, sizeof(buf)));
+    return now_ns() - start;
+}
+
+static uint64_t run_rt(struct list_head *q, size_t n, char **strs)
+{
+    char buf[256];
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        q_release_element(q_remove_tail(q, buf, sizeof(buf)));
+    return now_ns() - start;
+}
+
+/* Operations running once over the whole queue */
+#define RUN_ONCE(op, call)                                                \
+    static uint64_t run_##op(struct list_head *q, size_t n, char **strs) \
+    {                                                                     \
+        uint64_t start = now_ns();                                        \
+        call;                                                             \
+        return now_ns() - start;                                          \
+    }
+
+RUN_ONCE(size, q_size(q))
+RUN_ONCE(reverse, q_reverse(q))
+RUN_ONCE(swap, q_swap(q))
+RUN_ONCE(sort, q_sort(q))
+RUN_ONCE(dm, q_delete_mid(q))
+RUN_ONCE(dedup, q_delete_dup(q))
+
+static const bench_op_t ops[] = {
+    {"ih", run_ih, false, true, false},
+    {"it", run_it, false, true, false},
+    {"rh", run_rh, false, true, true},
+    {"rt", run_rt, false, true, true},
+    {"size", run_size, false, false, true},
+    {"reverse", run_reverse, false, false, true},
+    {"swap", run_swap, false, false, true},
+    {"sort", run_sort, true, true, true},
+    {"dm", run_dm, false, false, true},
+    {"dedup", run_dedup, true, true, true},
+    /* Measured by freeing the queue after every other operation */
+    {"free", NULL, false, true, true},
+};
+
+static int cmp_str(const void *a, const void *b)
+{
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Fill pool with n random strings of given length distribution */
+static char **make_strings(size_t n, const length_dist_t *ld, char **pool)
+{
+    char **strs = malloc(n * sizeof(char *));
+    char *buf = malloc(n * ld->max);
+    if (!strs || !buf) {
+        fprintf(stderr, "Cannot allocate %zu strings\n", n);
+        exit(1);
+    }
+
+    char *p = buf;
+    for (size_t i = 0; i < n; i++) {
+        int len = ld->min + rng_next() % (ld->max - ld->min);
+        strs[i] = p;
+        for (int j = 0; j < len; j++)
+            *p++ = 'a' + rng_next() % 26;
+        *p++ = '\0';
+    }
+    *pool = buf;
+    return strs;
+}
+
+/* Arrange strings in given order, from randomly generated ones */
+static void arrange(char **dst, char **src, size_t n, int order)
+{
+    memcpy(dst, src, n * sizeof(char *));
+    if (order == ORDER_SORTED || order == ORDER_REVERSED)
+        qsort(dst, n, sizeof(char *), cmp_str);
+    if (order == ORDER_REVERSED) {
+        for (size_t i = 0; i < n / 2; i++) {
+            char *t = dst[i];
+            dst[i] = dst[n - 1 - i];
+            dst[n - 1 - i] = t;
+        }
+    }
+    if (order == ORDER_EQUAL) {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = src[0];
+    }
+}
+
+static struct list_head *build(char **strs, size_t n, bool prefill)
+{
+    struct list_head *q = q_new();
+    if (!q) {
+        fprintf(stderr, "q_new failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; prefill && i < n; i++)
+        q_insert_tail(q, strs[i]);
+    return q;
+}
+
+/* Measure op on n strings, repeating on small queues */
+static void measure(const bench_op_t *op, char **strs, size_t n, result_t *r)
+{
+    int reps = MIN_WORK / n;
+    if (reps < 3)
+        reps = 3;
+    uint64_t *times = malloc(reps * sizeof(uint64_t));
+    if (!times)
+        exit(1);
+
+    for (int i = 0; i < reps; i++) {
+        if (op->run) {
+            struct list_head *q = build(strs, n, op->prefill);
+            times[i] = op->run(q, n, strs);
+            q_free(q);
+        } else {
+            struct list_head *q = build(strs, n, true);
+            uint64_t start = now_ns();
+            q_free(q);
+            times[i] = now_ns() - start;
+        }
+    }
+
+    qsort(times, reps, sizeof(uint64_t), cmp_u64);
+    r->reps = reps;
+    r->min_ns = times[0];
+    r->median_ns = times[reps / 2];
+    r->ns_per_elem = r->min_ns / n;
+    free(times);
+}
+
+static void write_result(FILE *fp, const result_t *r, bool first)
+{
+    fprintf(fp,
+            "%s\n    {\"op\": \"%s\", \"size\": %ld, \"order\": \"%s\", "
+            "\"length\": \"%s\", \"reps\": %d, \"min_ns\": %.0f, "
+            "\"median_ns\": %.0f, \"ns_per_elem\": %.3f}",
+            first ? "" : ",", r->op, r->size, r->order, r->length, r->reps,
+            r->min_ns, r->median_ns, r->ns_per_elem);
+}
+
+/* Read results written by write_result.  Return number of results */
+static size_t read_results(char *fname, result_t **resp)
+{
+    FILE *fp = fopen(fname, "r");
+    if (!fp) {
+        fprintf(stderr, "Cannot open baseline '%s'\n", fname);
+        exit(1);
+    }
+
+    size_t cnt = 0, size = 0;
+    result_t *res = NULL;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        result_t r;
+        if (sscanf(line,
+                   " {\"op\": \"%15[^\"]\", \"size\": %ld, \"order\": "
+                   "\"%15[^\"]\", \"length\": \"%15[^\"]\", \"reps\": %d, "
+                   "\"min_ns\": %lf, \"median_ns\": %lf, \"ns_per_elem\": "
+                   "%lf}",
+                   r.op, &r.size, r.order, r.length, &r.reps, &r.min_ns,
+                   &r.median_ns, &r.ns_per_elem) != 8)
+            continue;
+        if (cnt == size) {
+            size = size ? 2 * size : 64;
+            res = realloc(res, size * sizeof(result_t));
+            if (!res)
+                exit(1);
+        }
+        res[cnt++] = r;
+    }
+    fclose(fp);
+    *resp = res;
+    return cnt;
+}
+
+/* Report whether r regressed by more than threshold percent */
+static bool regressed(const result_t *r,
+                      const result_t *base,
+                      size_t nbase,
+                      int threshold)
+{
+    for (size_t i = 0; i < nbase; i++) {
+        const result_t *b = &base[i];
+        if (strcmp(b->op, r->op) || b->size != r->size ||
+            strcmp(b->order, r->order) || strcmp(b->length, r->length))
+            continue;
+        double change = 100.0 * (r->min_ns - b->min_ns) / b->min_ns;
+        if (change <= threshold)
+            return false;
+        fprintf(stderr,
+                "REGRESSION %s size %ld %s %s: %.0f ns -> %.0f ns (%+.1f%%)\n",
+                r->op, r->size, r->order, r->length, b->min_ns, r->min_ns,
+                change);
+        return true;
+    }
+    return false;
+}
+
+static void usage(char *cmd)
+{
+    printf("Usage: %s [-h] [-n MAXSIZE] [-p OP] [-o FILE] [-b FILE] [-t PCT]\n",
+           cmd);
+    printf("\t-h          Print this information\n");
+    printf("\t-n MAXSIZE  Largest queue size, up to %d (default: 1000000)\n",
+           MAX_SIZE);
+    printf("\t-p OP       Only measure operation OP\n");
+    printf("\t-o FILE     Write results to FILE (default: stdout)\n");
+    printf("\t-b FILE     Compare against baseline results in FILE\n");
+    printf("\t-t PCT      Slowdown flagged as regression (default: 10)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    long max_size = 1000000;
+    char *only_op = NULL, *out_name = NULL, *base_name = NULL;
+    int threshold = 10;
+    int c;
+
+    while ((c = getopt(argc, argv, "hn:p:o:b:t:")) != -1) {
+        switch (c) {
+        case 'n':
+            max_size = atol(optarg);
+            if (max_size < MIN_SIZE || max_size > MAX_SIZE) {
+                fprintf(stderr, "Size must be in %d..%d\n", MIN_SIZE,
+                        MAX_SIZE);
+                exit(1);
+            }
+            break;
+        case 'p':
+            only_op = optarg;
+            break;
+        case 'o':
+            out_name = optarg;
+            break;
+        case 'b':
+            base_name = optarg;
+            break;
+        case 't':
+            threshold = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            break;
+        }
+    }
+
+#ifdef BENCH_HARNESS
+    /* Checking every free against all allocated blocks would dominate */
+    set_cautious_mode(false);
+#endif
+
+    result_t *base = NULL;
+    size_t nbase = base_name ? read_results(base_name, &base) : 0;
+    FILE *fp = out_name ? fopen(out_name, "w") : stdout;
+    if (!fp) {
+        fprintf(stderr, "Cannot open '%s'\n", out_name);
+        exit(1);
+    }
+
+#ifdef BENCH_HARNESS
+    fprintf(fp, "{\n  \"harness\": true,\n  \"results\": [");
+#else
+    fprintf(fp, "{\n  \"harness\": false,\n  \"results\": [");
+#endif
+
+    bool first = true;
+    int regressions = 0;
+    size_t nops = sizeof(ops) / sizeof(ops[0]);
+    size_t nlengths = sizeof(lengths) / sizeof(lengths[0]);
+    for (size_t l = 0; l < nlengths; l++) {
+        for (long n = MIN_SIZE; n <= max_size; n *= 10) {
+            char *pool;
+            char **strs = make_strings(n, &lengths[l], &pool);
+            char **arranged = malloc(n * sizeof(char *));
+            if (!arranged)
+                exit(1);
+
+            for (int order = 0; order < N_ORDERS; order++) {
+                arrange(arranged, strs, n, order);
+                for (size_t i = 0; i < nops; i++) {
+                    const bench_op_t *op = &ops[i];
+                    if ((only_op && strcmp(only_op, op->name)) ||
+                        (!op->by_order && order != ORDER_RANDOM) ||
+                        (!op->by_length && l != 0))
+                        continue;
+
+                    result_t r;
+                    snprintf(r.op, sizeof(r.op), "%s", op->name);
+                    snprintf(r.order, sizeof(r.order), "%s",
+                             order_names[order]);
+                    snprintf(r.length, sizeof(r.length), "%s",
+                             lengths[l].name);
+                    r.size = n;
+                    measure(op, arranged, n, &r);
+                    write_result(fp, &r, first);
+                    fflush(fp);
+                    first = false;
+                    if (base && regressed(&r, base, nbase, threshold))
+                        regressions++;
+                }
+            }
+            free(arranged);
+            free(strs);
+            free(pool);
+        }
+    }
+
+    fprintf(fp, "\n  ]\n}\n");
+    if (fp != stdout)
+        fclose(fp);
+    free(base);
+
+    if (regressions)
+        fprintf(stderr, "%d regression(s) against '%s'\n", regressions,
+                base_name);
+    return regressions > 0;
+}
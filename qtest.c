@@ -2,6 +2,8 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -12,7 +14,9 @@
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#include "cpucycles.h"
 #include "dudect/fixture.h"
+#include "dudect/timer.h"
 #include "list.h"
 
 /* Our program needs to use regular malloc/free */
@@ -33,7 +37,10 @@
 #include "queue.h"
 
 #include "console.h"
+#include "random.h"
 #include "report.h"
+#include "snapshot.h"
+#include "workload.h"
 
 /* Settable parameters */
 
@@ -66,10 +73,46 @@ static int fail_count = 0;
 
 static int string_length = MAXSTRING;
 
+/* Random strings have lengths from rand_min_len to rand_max_len, which
+ * must fit in buffers of MAX_RANDSTR_LEN bytes.
+ */
 #define MIN_RANDSTR_LEN 5
-#define MAX_RANDSTR_LEN 10
+#define MAX_RANDSTR_LEN 256
+static int rand_min_len = MIN_RANDSTR_LEN;
+static int rand_max_len = 9;
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
 
+/* Characters taken from each 64-bit draw of string_rng */
+#define CHARS_PER_DRAW 8
+static rng_t string_rng;
+static bool string_rng_seeded = false;
+
+/* How thoroughly show_queue checks the links of the queue */
+#define CHECK_FULL 0
+#define CHECK_LOCAL 1
+#define CHECK_SAMPLED 2
+static int check_mode = CHECK_FULL;
+
+/* Nodes checked at each end of the queue by local checks */
+static int check_window = 16;
+
+/* Local checks are backed by a full check every check_every calls, or with
+ * probability 1 / check_every when sampled (0 = never)
+ */
+static int check_every = 0;
+static int check_calls = 0;
+
+/* Samples full checks, apart from random_u64() so that check settings do
+ * not change the strings drawn after option seed
+ */
+static rng_t check_rng;
+static bool check_rng_seeded = false;
+
+/* Set by commands that may relink any node of the queue.  They take linear
+ * time or more anyway, so a full check does not change their complexity.
+ */
+static bool check_full_pending = false;
+
 /* Forward declarations */
 static bool show_queue(int vlevel);
 
@@ -87,6 +130,7 @@ static bool do_free(int argc, char *argv[])
 
     if (lcnt > big_list_size)
         set_cautious_mode(false);
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         q_free(l_meta.l);
     exception_cancel();
@@ -132,48 +176,94 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
+/* Check rand_min_len and rand_max_len as a pair, when strings are about
+ * to be drawn, so that the order in which they are set does not matter
+ */
+static bool rand_len_valid()
+{
+    if (rand_min_len >= 1 && rand_min_len <= rand_max_len &&
+        rand_max_len < MAX_RANDSTR_LEN)
+        return true;
+    report(1, "Random string lengths must satisfy 1 <= min <= max < %d",
+           MAX_RANDSTR_LEN);
+    return false;
+}
+
+/* Multiplying a uniform 64-bit fraction by the size of the charset moves
+ * the next character index into the upper bits and leaves the remaining
+ * fraction in the lower ones, so one draw yields several characters.
+ * Each takes less than 5 of the 64 bits, which keeps the bias negligible.
  */
 static void fill_rand_string(char *buf, size_t buf_size)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
+    const uint64_t m = sizeof charset - 1;
+    if (!string_rng_seeded) {
+        rng_seed(&string_rng, random_u64());
+        string_rng_seeded = true;
+    }
 
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[rand() % (sizeof charset - 1)];
+    uint64_t span = rand_max_len - rand_min_len + 1;
+    size_t len = rand_min_len + rng_scale(rng_next(&string_rng), span);
+    if (len >= buf_size)
+        len = buf_size - 1;
+
+    for (size_t n = 0; n < len; n += CHARS_PER_DRAW) {
+        uint64_t r = rng_next(&string_rng);
+        size_t end = n + CHARS_PER_DRAW < len ? n + CHARS_PER_DRAW : len;
+        for (size_t i = n; i < end; i++) {
+            buf[i] = charset[rng_scale(r, m)];
+            r *= m;
+        }
+    }
     buf[len] = '\0';
 }
 
+/* Test if operation registered with dudect as argv[0] is constant time */
+static bool simulate(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s does not need arguments in simulation mode", argv[0]);
+        return false;
+    }
+    bool ok = is_const(argv[0]);
+    if (!ok) {
+        report(1, "ERROR: Probably not constant time");
+        return false;
+    }
+    report(1, "Probably constant time");
+    return ok;
+}
+
+/* Operation registered with dudect that has no command of its own */
+static bool do_simulate(int argc, char *argv[])
+{
+    if (!simulation) {
+        report(1, "%s is only available in simulation mode", argv[0]);
+        return false;
+    }
+    return simulate(argc, argv);
+}
+
 /* insert head */
 static bool do_ih(int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok = is_insert_head_const();
-        if (!ok) {
-            report(1, "ERROR: Probably not constant time");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation && dut_find(argv[0]))
+        return simulate(argc, argv);
 
     char *lasts = NULL;
     char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
-    if (argc != 2 && argc != 3) {
-        report(1, "%s needs 1-2 arguments", argv[0]);
+    workload_t wl;
+    bool need_workload = argc > 3;
+    if (argc < 2) {
+        report(1, "%s needs 1-2 arguments, and options after RAND n",
+               argv[0]);
         return false;
     }
 
     char *inserts = argv[1];
-    if (argc == 3) {
+    if (argc >= 3) {
         if (!get_int(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
@@ -185,13 +275,27 @@ static bool do_ih(int argc, char *argv[])
         inserts = randstr_buf;
     }
 
+    if (need_workload && !need_rand) {
+        report(1, "%s takes options only after RAND n", argv[0]);
+        return false;
+    }
+    if (need_workload &&
+        !workload_init(&wl, reps, rand_min_len, rand_max_len,
+                       sizeof(randstr_buf), argc - 3, argv + 3))
+        return false;
+    if (need_rand && !need_workload && !rand_len_valid())
+        return false;
+
     if (!l_meta.l)
         report(3, "Warning: Calling insert head on null queue");
     error_check();
 
+    set_budget_elements(reps);
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
+            if (need_workload)
+                workload_next(&wl, randstr_buf, sizeof(randstr_buf));
+            else if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_head(l_meta.l, inserts);
             if (rval) {
@@ -239,30 +343,22 @@ static bool do_ih(int argc, char *argv[])
 /* insert tail */
 static bool do_it(int argc, char *argv[])
 {
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok = is_insert_tail_const();
-        if (!ok) {
-            report(1, "ERROR: Probably not constant time");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
+    if (simulation && dut_find(argv[0]))
+        return simulate(argc, argv);
 
     char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
-    if (argc != 2 && argc != 3) {
-        report(1, "%s needs 1-2 arguments", argv[0]);
+    workload_t wl;
+    bool need_workload = argc > 3;
+    if (argc < 2) {
+        report(1, "%s needs 1-2 arguments, and options after RAND n",
+               argv[0]);
         return false;
     }
 
     char *inserts = argv[1];
-    if (argc == 3) {
+    if (argc >= 3) {
         if (!get_int(argv[2], &reps)) {
             report(1, "Invalid number of insertions '%s'", argv[2]);
             return false;
@@ -274,13 +370,27 @@ static bool do_it(int argc, char *argv[])
         inserts = randstr_buf;
     }
 
+    if (need_workload && !need_rand) {
+        report(1, "%s takes options only after RAND n", argv[0]);
+        return false;
+    }
+    if (need_workload &&
+        !workload_init(&wl, reps, rand_min_len, rand_max_len,
+                       sizeof(randstr_buf), argc - 3, argv + 3))
+        return false;
+    if (need_rand && !need_workload && !rand_len_valid())
+        return false;
+
     if (!l_meta.l)
         report(3, "Warning: Calling insert tail on null queue");
     error_check();
 
+    set_budget_elements(reps);
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
+            if (need_workload)
+                workload_next(&wl, randstr_buf, sizeof(randstr_buf));
+            else if (need_rand)
                 fill_rand_string(randstr_buf, sizeof(randstr_buf));
             bool rval = q_insert_tail(l_meta.l, inserts);
             if (rval) {
@@ -315,25 +425,8 @@ static bool do_remove(int option, int argc, char *argv[])
 {
     // option 0 is for remove head; option 1 is for remove tail
 
-    /* FIXME: It is known that both functions is_remove_tail_const() and
-     * is_remove_head_const() can not pass dudect on Arm64. We shall figure
-     * out the exact reasons and resolve later.
-     */
-#if !defined(__aarch64__)
-    if (simulation) {
-        if (argc != 1) {
-            report(1, "%s does not need arguments in simulation mode", argv[0]);
-            return false;
-        }
-        bool ok = option ? is_remove_tail_const() : is_remove_head_const();
-        if (!ok) {
-            report(1, "ERROR: Probably not constant time");
-            return false;
-        }
-        report(1, "Probably constant time");
-        return ok;
-    }
-#endif
+    if (simulation && dut_find(argv[0]))
+        return simulate(argc, argv);
 
     if (argc != 1 && argc != 2) {
         report(1, "%s needs 0-1 arguments", argv[0]);
@@ -480,6 +573,40 @@ static bool do_rhq(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* Digests of queue contents, so that dedup and sort can be verified in a
+ * single pass over their output instead of against a copy of the queue.
+ * The set digest is a sum of string hashes and ignores order; the seq
+ * digest also depends on it.
+ */
+typedef struct {
+    uint64_t set;
+    uint64_t seq;
+    size_t count;
+} digest_t;
+
+static uint64_t str_hash(const char *s)
+{
+    /* FNV-1a, followed by the splitmix64 finalizer so that sums of hashes
+     * do not cancel out for similar strings.
+     */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 0x100000001b3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+static void digest_add(digest_t *d, const char *s)
+{
+    uint64_t h = str_hash(s);
+    d->set += h;
+    d->seq = d->seq * 0x9e3779b97f4a7c15ULL + h;
+    d->count++;
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -487,86 +614,55 @@ static bool do_dedup(int argc, char *argv[])
         return false;
     }
 
-    LIST_HEAD(l_copy);
-    element_t *item = NULL, *tmp = NULL;
-
-    // Copy l_meta.l to l_copy
-    if (l_meta.l && !list_empty(l_meta.l)) {
+    /* Strings equal to neither neighbour must remain, in the same order */
+    digest_t expect = {0}, got = {0};
+    size_t removed = 0;
+    element_t *item;
+    if (l_meta.l) {
+        bool is_this_dup = false;
         list_for_each_entry (item, l_meta.l, list) {
-            size_t slen;
-            tmp = malloc(sizeof(element_t));
-            if (!tmp)
-                break;
-            INIT_LIST_HEAD(&tmp->list);
-            slen = strlen(item->value) + 1;
-            tmp->value = malloc(slen);
-            if (!tmp->value) {
-                free(tmp);
-                break;
-            }
-            memcpy(tmp->value, item->value, slen);
-            list_add_tail(&tmp->list, &l_copy);
-        }
-        // Return false if the loop does not leave properly
-        if (&item->list != l_meta.l) {
-            list_for_each_entry_safe (item, tmp, &l_copy, list) {
-                free(item->value);
-                free(item);
-            }
-            report(1,
-                   "INTERNAL ERROR.  Could not allocate space for "
-                   "duplicate checking");
-            return false;
+            bool is_next_dup =
+                item->list.next != l_meta.l &&
+                strcmp(list_entry(item->list.next, element_t, list)->value,
+                       item->value) == 0;
+            if (is_this_dup || is_next_dup)
+                removed++;
+            else
+                digest_add(&expect, item->value);
+            is_this_dup = is_next_dup;
         }
     }
 
     bool ok = true;
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         ok = q_delete_dup(l_meta.l);
     exception_cancel();
 
     if (!ok) {
-        list_for_each_entry_safe (item, tmp, &l_copy, list) {
-            free(item->value);
-            free(item);
-        }
         report(1, "ERROR: Calling delete duplicate on null queue");
         return false;
     }
 
-    struct list_head *l_tmp = l_meta.l->next;
-    bool is_this_dup = false;
-    // Compare between new list and old one
-    list_for_each_entry (item, &l_copy, list) {
-        // Skip comparison with new list if the string is duplicate
-        bool is_next_dup =
-            item->list.next != &l_copy &&
-            strcmp(list_entry(item->list.next, element_t, list)->value,
-                   item->value) == 0;
-        if (is_this_dup || is_next_dup) {
-            // Update list size
-            lcnt--;
-            l_meta.size--;
-        } else if (l_tmp != l_meta.l &&
-                   strcmp(list_entry(l_tmp, element_t, list)->value,
-                          item->value) == 0)
-            l_tmp = l_tmp->next;
-        else
-            ok = false;
-        is_this_dup = is_next_dup;
+    lcnt -= removed;
+    l_meta.size -= removed;
+
+    list_for_each_entry (item, l_meta.l, list) {
+        /* Bail out on more elements than expected, in case of a cycle */
+        if (got.count == expect.count) {
+            got.count++;
+            break;
+        }
+        digest_add(&got, item->value);
     }
-    // All elements in new list should be traversed
-    ok = ok && l_tmp == l_meta.l;
-    if (!ok)
+    if (got.count != expect.count || got.seq != expect.seq) {
         report(1,
                "ERROR: Duplicate strings are in queue or distinct strings are "
                "not in queue");
-
-    list_for_each_entry_safe (item, tmp, &l_copy, list) {
-        free(item->value);
-        free(item);
+        ok = false;
     }
 
+    check_full_pending = true;
     show_queue(3);
     return ok && !error_check();
 }
@@ -583,17 +679,22 @@ static bool do_reverse(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         q_reverse(l_meta.l);
     exception_cancel();
 
     set_noallocate_mode(false);
+    check_full_pending = true;
     show_queue(3);
     return !error_check();
 }
 
 static bool do_size(int argc, char *argv[])
 {
+    if (simulation && dut_find(argv[0]))
+        return simulate(argc, argv);
+
     if (argc != 1 && argc != 2) {
         report(1, "%s takes 0-1 arguments", argv[0]);
         return false;
@@ -617,6 +718,7 @@ static bool do_size(int argc, char *argv[])
         report(3, "Warning: Calling size on null queue");
     error_check();
 
+    set_budget_elements((size_t) reps * lcnt);
     if (exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             cnt = q_size(l_meta.l);
@@ -657,7 +759,15 @@ bool do_sort(int argc, char *argv[])
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    digest_t expect = {0}, got = {0};
+    element_t *item;
+    if (l_meta.l) {
+        list_for_each_entry (item, l_meta.l, list)
+            digest_add(&expect, item->value);
+    }
+
     set_noallocate_mode(true);
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         q_sort(l_meta.l);
     exception_cancel();
@@ -665,21 +775,30 @@ bool do_sort(int argc, char *argv[])
 
     bool ok = true;
     if (l_meta.size) {
-        for (struct list_head *cur_l = l_meta.l->next;
-             cur_l != l_meta.l && --cnt; cur_l = cur_l->next) {
+        const char *prev = NULL;
+        list_for_each_entry (item, l_meta.l, list) {
             /* Ensure each element in ascending order */
             /* FIXME: add an option to specify sorting order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (strcasecmp(item->value, next_item->value) > 0) {
+            if (prev && strcasecmp(prev, item->value) > 0) {
                 report(1, "ERROR: Not sorted in ascending order");
                 ok = false;
                 break;
             }
+            /* Bail out on more elements than expected, in case of a cycle */
+            if (got.count == expect.count) {
+                got.count++;
+                break;
+            }
+            digest_add(&got, item->value);
+            prev = item->value;
+        }
+        if (ok && (got.count != expect.count || got.set != expect.set)) {
+            report(1, "ERROR: Sorted queue does not hold the original strings");
+            ok = false;
         }
     }
 
+    check_full_pending = true;
     show_queue(3);
     return ok && !error_check();
 }
@@ -701,6 +820,7 @@ static bool do_dm(int argc, char *argv[])
     exception_cancel();
 
     lcnt--;
+    check_full_pending = true;
     show_queue(3);
     return ok && !error_check();
 }
@@ -717,16 +837,588 @@ static bool do_swap(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         q_swap(l_meta.l);
     exception_cancel();
 
     set_noallocate_mode(false);
 
+    check_full_pending = true;
     show_queue(3);
     return !error_check();
 }
 
+static bool do_save(int argc, char *argv[])
+{
+    if (argc != 2) {
+        report(1, "%s needs 1 argument", argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l) {
+        report(1, "ERROR: Calling save on null queue");
+        return false;
+    }
+
+    if (!snapshot_save(argv[1], l_meta.l)) {
+        report(1, "Couldn't save queue to '%s'", argv[1]);
+        return false;
+    }
+    return true;
+}
+
+static bool do_load(int argc, char *argv[])
+{
+    bool zerocopy = argc == 3 && strcmp(argv[2], "zerocopy") == 0;
+    if (argc != 2 && !zerocopy) {
+        report(1, "%s needs a file, optionally followed by zerocopy",
+               argv[0]);
+        return false;
+    }
+
+    if (!l_meta.l) {
+        report(1, "ERROR: Calling load on null queue");
+        return false;
+    }
+
+    snapshot_t snap;
+    if (!snapshot_open(&snap, argv[1])) {
+        report(1, "Couldn't load queue from '%s'", argv[1]);
+        return false;
+    }
+
+    /* Elements, and copies of the strings unless they are used in place,
+     * are carved from one region of harness blocks.
+     */
+    size_t n = snap.count;
+    void *region = NULL, *foreign = NULL;
+    if (n) {
+        size_t nblocks = zerocopy ? n : 2 * n;
+        size_t bytes = n * sizeof(element_t) + (zerocopy ? 0 : snap.blob_size);
+        region = test_bulk_new(nblocks, bytes);
+        /* The harness unmaps the file once the last string in it is freed */
+        if (region && zerocopy) {
+            foreign = test_foreign_new(snap.map, snap.map_len, snapshot_unmap);
+            if (!foreign) {
+                test_bulk_done(region);
+                region = NULL;
+            }
+        }
+        if (!region) {
+            snapshot_close(&snap);
+            report(1,
+                   "INTERNAL ERROR.  Could not allocate space for queue "
+                   "file");
+            return false;
+        }
+    }
+
+    LIST_HEAD(loaded);
+    for (size_t i = 0; i < n; i++) {
+        element_t *e = test_bulk_alloc(region, sizeof(element_t));
+        char *str = (char *) snap.blob + snap.offsets[i];
+        if (zerocopy) {
+            e->value = str;
+            test_foreign_block(foreign, str);
+        } else {
+            size_t len = snapshot_len(&snap, i) + 1;
+            e->value = test_bulk_alloc(region, len);
+            memcpy(e->value, str, len);
+        }
+        list_add_tail(&e->list, &loaded);
+    }
+    if (region)
+        test_bulk_done(region);
+    if (!foreign)
+        snapshot_close(&snap);
+
+    list_splice_tail(&loaded, l_meta.l);
+    lcnt += n;
+    l_meta.size += n;
+    report(2, "Loaded %zu elements", n);
+
+    show_queue(3);
+    return !error_check();
+}
+
+/* Queue operations measured by bench, each run once on queue q */
+typedef struct {
+    char *name;
+    void (*run)(struct list_head *q);
+    /* Rebuild queue before every run, since run changes what it measures */
+    bool reset;
+} bench_op_t;
+
+#define BENCH_STRING "bench"
+
+static void bench_ih(struct list_head *q)
+{
+    q_insert_head(q, BENCH_STRING);
+}
+
+static void bench_it(struct list_head *q)
+{
+    q_insert_tail(q, BENCH_STRING);
+}
+
+static void bench_rh(struct list_head *q)
+{
+    char buf[MAXSTRING];
+    element_t *e = q_remove_head(q, buf, sizeof(buf));
+    if (e)
+        q_release_element(e);
+}
+
+static void bench_rt(struct list_head *q)
+{
+    char buf[MAXSTRING];
+    element_t *e = q_remove_tail(q, buf, sizeof(buf));
+    if (e)
+        q_release_element(e);
+}
+
+static void bench_size(struct list_head *q)
+{
+    q_size(q);
+}
+
+static void bench_dm(struct list_head *q)
+{
+    q_delete_mid(q);
+}
+
+static void bench_dedup(struct list_head *q)
+{
+    q_delete_dup(q);
+}
+
+static const bench_op_t bench_ops[] = {
+    {"ih", bench_ih, false},
+    {"it", bench_it, false},
+    {"rh", bench_rh, false},
+    {"rt", bench_rt, false},
+    {"size", bench_size, false},
+    {"reverse", q_reverse, false},
+    {"swap", q_swap, false},
+    {"sort", q_sort, true},
+    {"dm", bench_dm, true},
+    {"dedup", bench_dedup, true},
+};
+
+static const bench_op_t *find_bench_op(char *name)
+{
+    for (size_t i = 0; i < sizeof(bench_ops) / sizeof(bench_ops[0]); i++) {
+        if (strcmp(bench_ops[i].name, name) == 0)
+            return &bench_ops[i];
+    }
+    return NULL;
+}
+
+/* Make scratch copy of queue being tested, empty when there is none */
+static struct list_head *bench_copy()
+{
+    struct list_head *q = q_new();
+    if (!q || !l_meta.l)
+        return q;
+
+    element_t *e;
+    list_for_each_entry (e, l_meta.l, list)
+        q_insert_tail(q, e->value);
+    return q;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Report distribution of n samples, sorting them in place */
+static void bench_report(char *unit, int64_t *samples, int n)
+{
+    double sum = 0, sq = 0;
+    for (int i = 0; i < n; i++)
+        sum += samples[i];
+    double mean = sum / n;
+    for (int i = 0; i < n; i++)
+        sq += (samples[i] - mean) * (samples[i] - mean);
+
+    qsort(samples, n, sizeof(int64_t), cmp_int64);
+    report(1,
+           "  %-6s min %9" PRId64 "  median %9" PRId64 "  p99 %9" PRId64
+           "  mean %11.1f  stddev %11.1f",
+           unit, samples[0], samples[n / 2], samples[(int) (0.99 * (n - 1))],
+           mean, n > 1 ? sqrt(sq / (n - 1)) : 0.0);
+}
+
+static bool do_bench(int argc, char *argv[])
+{
+    int iters = 0, warmup = 10;
+    if (argc != 3 && argc != 4) {
+        report(1, "%s needs 2-3 arguments", argv[0]);
+        return false;
+    }
+
+    const bench_op_t *op = find_bench_op(argv[1]);
+    if (!op) {
+        report(1, "Cannot bench '%s'", argv[1]);
+        return false;
+    }
+    if (!get_int(argv[2], &iters) || iters <= 0) {
+        report(1, "Invalid number of iterations '%s'", argv[2]);
+        return false;
+    }
+    if (argc == 4 && (!get_int(argv[3], &warmup) || warmup < 0)) {
+        report(1, "Invalid number of warmup iterations '%s'", argv[3]);
+        return false;
+    }
+
+    int64_t *cycles = malloc(iters * sizeof(int64_t));
+    int64_t *ns = malloc(iters * sizeof(int64_t));
+    if (!cycles || !ns) {
+        report(1, "INTERNAL ERROR.  Could not allocate space for samples");
+        free(cycles);
+        free(ns);
+        return false;
+    }
+
+    /* Run on scratch copy, leaving queue being tested as it is.
+     * Checking every free against all allocated blocks would dominate.
+     */
+    error_check();
+    bool cautious = set_cautious_mode(false);
+    /* Assigned after exception_setup, so volatile to survive a longjmp */
+    struct list_head *volatile q = NULL;
+    volatile bool done = false;
+    if (exception_setup(false)) {
+        q = bench_copy();
+        for (int i = -warmup; q && i < iters; i++) {
+            if (op->reset || list_empty(q)) {
+                q_free(q);
+                q = bench_copy();
+                if (!q)
+                    break;
+            }
+
+            uint64_t start = latency_now();
+            int64_t before = cpucycles();
+            op->run(q);
+            int64_t after = cpucycles();
+            uint64_t end = latency_now();
+            if (i >= 0) {
+                cycles[i] = after - before;
+                ns[i] = end - start;
+            }
+        }
+        done = q != NULL;
+    }
+    exception_cancel();
+
+    /* Free scratch copy, also when an operation failed on it */
+    if (q && exception_setup(false))
+        q_free(q);
+    exception_cancel();
+    set_cautious_mode(cautious);
+
+    bool ok = done && !error_check();
+    if (ok) {
+        double total = 0;
+        for (int i = 0; i < iters; i++)
+            total += ns[i];
+        report(1, "bench %s: %d iterations, %d warmup, %.1f ops/sec",
+               op->name, iters, warmup, total > 0 ? iters * 1.0E9 / total : 0);
+        bench_report("cycles", cycles, iters);
+        bench_report("ns", ns, iters);
+    } else {
+        report(1, "ERROR: Could not bench %s", op->name);
+    }
+
+    free(cycles);
+    free(ns);
+    return ok;
+}
+
+/* Models fitted by complexity, cost = a + b * f(n) */
+typedef struct {
+    char *name;
+    double (*f)(double n);
+} complexity_t;
+
+static double cx_log(double n)
+{
+    return log2(n);
+}
+
+static double cx_n(double n)
+{
+    return n;
+}
+
+static double cx_nlogn(double n)
+{
+    return n * log2(n);
+}
+
+static double cx_n2(double n)
+{
+    return n * n;
+}
+
+static const complexity_t complexities[] = {
+    {"O(1)", NULL},         {"O(log n)", cx_log}, {"O(n)", cx_n},
+    {"O(n log n)", cx_nlogn}, {"O(n^2)", cx_n2},
+};
+
+#define N_COMPLEXITIES (sizeof(complexities) / sizeof(complexities[0]))
+
+#define CX_MIN_SIZE 64
+#define CX_DEFAULT_MAX (1 << 14)
+#define CX_MIN_POINTS 4
+/* Repeat at least CX_REPS times, and until CX_MIN_WORK ns have passed */
+#define CX_REPS 9
+#define CX_MAX_REPS 1000
+#define CX_MIN_WORK 2000000
+/* Higher class must improve BIC by this much to be preferred */
+#define CX_BIC_MARGIN 2
+/* Stop growing the queue once a size takes longer than this, in ns */
+#define CX_SIZE_BUDGET 500000000
+
+/* Fill q with n random strings, half of them repeating their predecessor
+ * so that dedup has work to do.
+ */
+static bool cx_fill(struct list_head *q, int n)
+{
+    char buf[MAX_RANDSTR_LEN];
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || rand() % 2)
+            fill_rand_string(buf, sizeof(buf));
+        if (!q_insert_tail(q, buf))
+            return false;
+    }
+    return true;
+}
+
+static struct list_head *cx_copy(struct list_head *src)
+{
+    struct list_head *q = q_new();
+    if (!q)
+        return NULL;
+
+    element_t *e;
+    list_for_each_entry (e, src, list) {
+        if (!q_insert_tail(q, e->value)) {
+            q_free(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+/* Source and scratch queues of cx_measure, kept here so that
+ * do_complexity can free them after a failed operation
+ */
+static struct list_head *volatile cx_src = NULL;
+static struct list_head *volatile cx_q = NULL;
+
+static void cx_free()
+{
+    q_free(cx_q);
+    q_free(cx_src);
+    cx_q = cx_src = NULL;
+}
+
+/* Minimum time of op over repeated runs on queues of n elements,
+ * or -1 on failure.
+ */
+static int64_t cx_measure(const bench_op_t *op, int n)
+{
+    cx_src = q_new();
+    if (!cx_src || !cx_fill(cx_src, n)) {
+        cx_free();
+        return -1;
+    }
+
+    int64_t best = -1;
+    uint64_t work = 0;
+    for (int i = 0; i < CX_MAX_REPS && (i < CX_REPS || work < CX_MIN_WORK);
+         i++) {
+        if (!cx_q || op->reset || list_empty(cx_q)) {
+            q_free(cx_q);
+            cx_q = cx_copy(cx_src);
+            if (!cx_q) {
+                best = -1;
+                break;
+            }
+        }
+
+        uint64_t start = latency_now();
+        op->run(cx_q);
+        int64_t t = latency_now() - start;
+        work += t;
+        if (best < 0 || t < best)
+            best = t;
+    }
+    cx_free();
+    return best;
+}
+
+/* Fit cost = a + b * f(n) to m points, by least squares on relative error.
+ * Return weighted residual sum of squares, or -1 when b would be negative.
+ */
+static double cx_fit(const complexity_t *c, double *n, double *t, int m)
+{
+    double sw = 0, sx = 0, sy = 0;
+    for (int i = 0; i < m; i++) {
+        double w = 1 / (t[i] * t[i]);
+        sw += w;
+        sx += w * (c->f ? c->f(n[i]) : 0);
+        sy += w * t[i];
+    }
+    double mx = sx / sw, my = sy / sw;
+
+    double b = 0;
+    if (c->f) {
+        double sxy = 0, sxx = 0;
+        for (int i = 0; i < m; i++) {
+            double w = 1 / (t[i] * t[i]), dx = c->f(n[i]) - mx;
+            sxy += w * dx * (t[i] - my);
+            sxx += w * dx * dx;
+        }
+        b = sxx > 0 ? sxy / sxx : 0;
+        if (b < 0)
+            return -1;
+    }
+    double a = my - b * mx;
+
+    double rss = 0;
+    for (int i = 0; i < m; i++) {
+        double r = (t[i] - a - b * (c->f ? c->f(n[i]) : 0)) / t[i];
+        rss += r * r;
+    }
+    return rss;
+}
+
+static bool do_complexity(int argc, char *argv[])
+{
+    int max_size = CX_DEFAULT_MAX;
+    if (argc != 2 && argc != 3) {
+        report(1, "%s needs 1-2 arguments", argv[0]);
+        return false;
+    }
+
+    const bench_op_t *op = find_bench_op(argv[1]);
+    if (!op) {
+        report(1, "Cannot measure complexity of '%s'", argv[1]);
+        return false;
+    }
+    if (argc == 3 && (!get_int(argv[2], &max_size) ||
+                      max_size < CX_MIN_SIZE << (CX_MIN_POINTS - 1))) {
+        report(1, "Invalid maximum size '%s', must be at least %d", argv[2],
+               CX_MIN_SIZE << (CX_MIN_POINTS - 1));
+        return false;
+    }
+    if (!rand_len_valid())
+        return false;
+
+    double sizes[32], times[32];
+    int m = 0;
+    bool ok = true;
+
+    /* Checking every free against all allocated blocks would dominate */
+    error_check();
+    bool cautious = set_cautious_mode(false);
+    if (exception_setup(false)) {
+        for (int n = CX_MIN_SIZE; n <= max_size; n *= 2) {
+            uint64_t start = latency_now();
+            int64_t t = cx_measure(op, n);
+            if (t < 0) {
+                ok = false;
+                break;
+            }
+            report(2, "  n = %8d  min %11" PRId64 " ns", n, t);
+            sizes[m] = n;
+            /* Keep weights finite for operations below clock resolution */
+            times[m++] = t > 0 ? t : 1;
+            if (latency_now() - start > CX_SIZE_BUDGET) {
+                report(1, "Stopped at %d elements, time budget exceeded", n);
+                break;
+            }
+        }
+    } else {
+        ok = false;
+    }
+    exception_cancel();
+
+    /* Queues left behind by a failed operation */
+    if (cx_q || cx_src) {
+        if (exception_setup(false))
+            cx_free();
+        exception_cancel();
+        cx_q = cx_src = NULL;
+    }
+    set_cautious_mode(cautious);
+
+    ok = ok && !error_check();
+    if (!ok) {
+        report(1, "ERROR: Could not measure complexity of %s", op->name);
+        return false;
+    }
+    if (m < CX_MIN_POINTS) {
+        report(1, "ERROR: Only %d sizes measured, need %d", m, CX_MIN_POINTS);
+        return false;
+    }
+
+    /* Rank models by Bayesian information criterion, which charges the
+     * constant model one parameter less than the others.  Caches make
+     * larger queues slower per element, so a lower class that is not
+     * clearly worse than a higher one is preferred.
+     */
+    double bic[N_COMPLEXITIES];
+    int best = -1, second = -1;
+    report(1, "complexity %s: %d sizes from %d to %.0f", op->name, m,
+           CX_MIN_SIZE, sizes[m - 1]);
+    for (size_t i = 0; i < N_COMPLEXITIES; i++) {
+        const complexity_t *c = &complexities[i];
+        double rss = cx_fit(c, sizes, times, m);
+        if (rss < 0) {
+            bic[i] = INFINITY;
+            report(1, "  %-12s decreasing, rejected", c->name);
+            continue;
+        }
+        int k = c->f ? 2 : 1;
+        bic[i] = m * log(fmax(rss, 1e-12) / m) + k * log(m);
+        report(1, "  %-12s relative rms error %6.1f%%", c->name,
+               100 * sqrt(rss / m));
+        if (best < 0 || bic[i] < bic[best] - CX_BIC_MARGIN) {
+            second = best;
+            best = i;
+        } else if (second < 0 || bic[i] < bic[second]) {
+            second = i;
+        }
+    }
+
+    if (best < 0) {
+        report(1, "ERROR: No model fits");
+        return false;
+    }
+    if (second < 0) {
+        report(1, "Best fit: %s, no other model fits",
+               complexities[best].name);
+        return true;
+    }
+    if (bic[second] <= bic[best]) {
+        report(1, "Best fit: %s, %s fits about as well",
+               complexities[best].name, complexities[second].name);
+        return true;
+    }
+    /* Posterior probability of best against runner-up */
+    double conf = 1 / (1 + exp(-(bic[second] - bic[best]) / 2));
+    report(1, "Best fit: %s, %.1f%% confidence over %s",
+           complexities[best].name, 100 * conf, complexities[second].name);
+    return true;
+}
+
 static bool is_circular()
 {
     struct list_head *cur = l_meta.l->next;
@@ -745,6 +1437,45 @@ static bool is_circular()
     return true;
 }
 
+/* Check that up to check_window nodes from one end of the queue link back
+ * to their neighbours.  Together with the other end, this covers what
+ * insertions and removals at either end can break.
+ */
+static bool links_ok(bool forward)
+{
+    struct list_head *cur = l_meta.l;
+    for (int i = 0; i <= check_window; i++) {
+        struct list_head *next = forward ? cur->next : cur->prev;
+        if (!next || (forward ? next->prev : next->next) != cur)
+            return false;
+        cur = next;
+        if (cur == l_meta.l)
+            return true;
+    }
+    return true;
+}
+
+static bool check_full()
+{
+    if (check_full_pending || check_mode == CHECK_FULL) {
+        check_full_pending = false;
+        return true;
+    }
+    if (check_every <= 0)
+        return false;
+    if (check_mode == CHECK_SAMPLED) {
+        if (!check_rng_seeded) {
+            rng_seed(&check_rng, (uint64_t) time(NULL));
+            check_rng_seeded = true;
+        }
+        return rng_scale(rng_next(&check_rng), check_every) == 0;
+    }
+    if (++check_calls < check_every)
+        return false;
+    check_calls = 0;
+    return true;
+}
+
 static bool show_queue(int vlevel)
 {
     bool ok = true;
@@ -757,7 +1488,9 @@ static bool show_queue(int vlevel)
         return true;
     }
 
-    if (!is_circular()) {
+    /* Only decided here, when a check is sure to run */
+    bool full = check_full();
+    if (full ? !is_circular() : !links_ok(true) || !links_ok(false)) {
         report(vlevel, "ERROR:  Queue is not doubly circular");
         return false;
     }
@@ -767,8 +1500,11 @@ static bool show_queue(int vlevel)
     struct list_head *ori = l_meta.l;
     struct list_head *cur = l_meta.l->next;
 
+    /* Only a full check counts all the elements */
+    int limit = full ? lcnt : big_list_size;
+    set_budget_elements(limit);
     if (exception_setup(true)) {
-        while (ok && ori != cur && cnt < lcnt) {
+        while (ok && ori != cur && cnt < limit) {
             element_t *e = list_entry(cur, element_t, list);
             if (cnt < big_list_size)
                 report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", e->value);
@@ -789,6 +1525,8 @@ static bool show_queue(int vlevel)
             report(vlevel, "]");
         else
             report(vlevel, " ... ]");
+    } else if (!full) {
+        report(vlevel, " ... ]");
     } else {
         report(vlevel, " ... ]");
         report(vlevel, "ERROR:  Queue has more than %d elements", lcnt);
@@ -804,21 +1542,54 @@ static bool do_show(int argc, char *argv[])
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
+    check_full_pending = true;
     return show_queue(0);
 }
 
+static bool do_fault(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "%s takes 0-1 arguments", argv[0]);
+        return false;
+    }
+
+    set_fault_site(argc == 2 ? argv[1] : NULL);
+    if (argc == 2)
+        report(2, "Malloc failures restricted to %s", argv[1]);
+    return true;
+}
+
+/* Seed of random strings and dudect inputs, fresh one each run when 0 */
+static int rand_seed = 0;
+
+static void seed_changed(int oldval)
+{
+    random_seed(rand_seed);
+    string_rng_seeded = false;
+    srand(rand_seed ? (unsigned int) rand_seed : (unsigned int) time(NULL));
+}
+
+/* Any change of fault injection options rearms the schedule */
+static void fault_changed(int oldval)
+{
+    fault_reset();
+}
+
 static void console_init()
 {
     ADD_COMMAND(new, "                | Create new queue");
     ADD_COMMAND(free, "                | Delete queue");
     ADD_COMMAND(
         ih,
-        " str [n]        | Insert string str at head of queue n times. "
-        "Generate random string(s) if str equals RAND. (default: n == 1)");
+        " str [n] [opts] | Insert string str at head of queue n times. "
+        "Generate random string(s) if str equals RAND, shaped by options "
+        "dist=uniform|zipf:S|sorted|reversed|dups:K len=MIN:MAX "
+        "alphabet=CHARS seed=N. (default: n == 1)");
     ADD_COMMAND(
         it,
-        " str [n]        | Insert string str at tail of queue n times. "
-        "Generate random string(s) if str equals RAND. (default: n == 1)");
+        " str [n] [opts] | Insert string str at tail of queue n times. "
+        "Generate random string(s) if str equals RAND, shaped by options "
+        "as for ih. (default: n == 1)");
     ADD_COMMAND(
         rh,
         " [str]          | Remove from head of queue.  Optionally compare "
@@ -838,14 +1609,73 @@ static void console_init()
     ADD_COMMAND(dm, "                | Delete middle node in queue");
     ADD_COMMAND(
         dedup, "                | Delete all nodes that have duplicate string");
+    ADD_COMMAND(save, " file           | Save strings of queue to file");
+    ADD_COMMAND(load,
+                " file [zerocopy] | Append strings saved in file to queue.  "
+                "With zerocopy, strings are used in place in a private "
+                "mapping of the file, which must not change meanwhile");
     ADD_COMMAND(swap,
                 "                | Swap every two adjacent nodes in queue");
+    ADD_COMMAND(bench,
+                " op n [w]       | Measure queue operation op (ih, it, rh, rt, "
+                "size, reverse, swap, sort, dm, dedup) n times after w "
+                "warmup runs, on a copy of the queue (default: w == 10)");
+    ADD_COMMAND(complexity,
+                " op [max]       | Fit running time of queue operation op "
+                "over queue sizes up to max to O(1), O(log n), O(n), "
+                "O(n log n) and O(n^2) (default: max == 16384)");
+    ADD_COMMAND(fault,
+                " [func]         | Only fail allocations made by function "
+                "func.  No argument removes the restriction");
+    for (const dut_t *op = dut_table; op->name; op++) {
+        if (!has_cmd(op->cmd))
+            add_cmd(op->cmd, do_simulate,
+                    "                | Test if operation is constant time "
+                    "(simulation mode only)");
+    }
+    add_param("dudect_sequential", &dudect_sequential,
+              "Stop dudect tests early once the verdict is clear", NULL);
+    add_param("dudect_timer", &dudect_timer,
+              "dudect timer (0 = auto, 1 = rdtsc, 2 = rdtscp+lfence, "
+              "3 = perf rdpmc, 4 = clock_gettime)",
+              NULL);
+    add_param("dudect_workers", &dudect_workers,
+              "Number of dudect measurement processes (0 = one per CPU)",
+              NULL);
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
+    add_param("seed", &rand_seed,
+              "Seed of random strings and dudect inputs (0 = random)",
+              seed_changed);
+    add_param("rand_min_len", &rand_min_len,
+              "Minimum length of random strings", NULL);
+    add_param("rand_max_len", &rand_max_len,
+              "Maximum length of random strings", NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
-              NULL);
+              fault_changed);
+    add_param("malloc_seed", &fail_seed,
+              "Seed of malloc failures (0 = random)", fault_changed);
+    add_param("malloc_every", &fail_every, "Fail every Nth malloc (0 = never)",
+              fault_changed);
+    add_param("malloc_nth", &fail_nth, "Fail the Kth malloc only (0 = never)",
+              fault_changed);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("check", &check_mode,
+              "Queue check after each command at verbose 3 (0 = full, "
+              "1 = ends only, 2 = ends, and full at random)",
+              NULL);
+    add_param("check_window", &check_window,
+              "Nodes checked at each end of queue by partial checks", NULL);
+    add_param("check_every", &check_every,
+              "Run a full check every N partial checks, or with probability "
+              "1/N when sampled (0 = never)",
+              NULL);
+    add_param("budget_us", &time_budget_us,
+              "Time budget of each operation in microseconds (0 = 1 second)",
+              NULL);
+    add_param("budget_elem_ns", &time_budget_elem_ns,
+              "Extra time budget per element in nanoseconds", NULL);
 }
 
 /* Signal handlers */
@@ -854,6 +1684,7 @@ static void sigsegvhandler(int sig)
     report(1,
            "Segmentation fault occurred.  You dereferenced a NULL or invalid "
            "pointer");
+    report_flush();
     /* Raising a SIGABRT signal to produce a core dump for debugging. */
     abort();
 }
@@ -873,12 +1704,19 @@ static void queue_init()
     signal(SIGALRM, sigalrmhandler);
 }
 
+/* Queue size sampled by event tracing */
+static size_t queue_size()
+{
+    return lcnt;
+}
+
 static bool queue_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
     if (lcnt > big_list_size)
         set_cautious_mode(false);
 
+    set_budget_elements(lcnt);
     if (exception_setup(true))
         q_free(l_meta.l);
     exception_cancel();
@@ -1005,6 +1843,7 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(queue_quit);
+    trace_set_probes(queue_size, allocation_check);
 
     bool ok = true;
     ok = ok && run_console(infile_name);
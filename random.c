@@ -1,39 +1,126 @@
 #include "random.h"
-#include <assert.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
 
-/* shameless stolen from ebacs */
-void randombytes(uint8_t *x, size_t how_much)
+/* Bytes generated at a time for randombytes() */
+#define RANDOM_BUFSIZE 4096
+
+static rng_t global_rng;
+static bool seeded = false;
+
+static uint8_t buf[RANDOM_BUFSIZE];
+static size_t buf_pos = RANDOM_BUFSIZE;
+
+/* Unused bits of the last word drawn by randombit() */
+static uint64_t bits;
+static int nbits = 0;
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void rng_seed(rng_t *rng, uint64_t seed)
 {
-    ssize_t i;
-    static int fd = -1;
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = splitmix64(&seed);
+}
 
-    ssize_t xlen = (ssize_t) how_much;
-    assert(xlen >= 0);
-    if (fd == -1) {
-        for (;;) {
-            fd = open("/dev/urandom", O_RDONLY);
-            if (fd != -1)
-                break;
+/* Read seed from the kernel, once per seeding rather than per call */
+static void seed_from_os(rng_t *rng)
+{
+    uint8_t *p = (uint8_t *) rng->s;
+    size_t left = sizeof(rng->s);
+#if defined(__linux__)
+    while (left > 0) {
+        ssize_t n = getrandom(p, left, 0);
+        if (n < 0)
+            break;
+        p += n;
+        left -= n;
+    }
+#endif
+    if (left > 0) {
+        int fd;
+        while ((fd = open("/dev/urandom", O_RDONLY)) == -1)
             sleep(1);
+        while (left > 0) {
+            ssize_t n = read(fd, p, left);
+            if (n < 1) {
+                sleep(1);
+                continue;
+            }
+            p += n;
+            left -= n;
         }
+        close(fd);
     }
+    /* All-zero state would only ever produce zeros */
+    if (!(rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3]))
+        rng->s[0] = 1;
+}
+
+void random_seed(uint64_t seed)
+{
+    if (seed)
+        rng_seed(&global_rng, seed);
+    else
+        seed_from_os(&global_rng);
+    seeded = true;
+    buf_pos = RANDOM_BUFSIZE;
+    nbits = 0;
+}
 
-    while (xlen > 0) {
-        if (xlen < 1048576)
-            i = xlen;
-        else
-            i = 1048576;
+uint64_t random_u64(void)
+{
+    if (!seeded)
+        random_seed(0);
+    return rng_next(&global_rng);
+}
 
-        i = read(fd, x, (size_t) i);
-        if (i < 1) {
-            sleep(1);
-            continue;
-        }
+static void refill(void)
+{
+    if (!seeded)
+        random_seed(0);
+    for (size_t i = 0; i < RANDOM_BUFSIZE; i += sizeof(uint64_t)) {
+        uint64_t r = rng_next(&global_rng);
+        memcpy(buf + i, &r, sizeof(r));
+    }
+    buf_pos = 0;
+}
 
-        x += i;
-        xlen -= i;
+void randombytes(uint8_t *x, size_t how_much)
+{
+    while (how_much > 0) {
+        if (buf_pos == RANDOM_BUFSIZE)
+            refill();
+        size_t n = RANDOM_BUFSIZE - buf_pos;
+        if (n > how_much)
+            n = how_much;
+        memcpy(x, buf + buf_pos, n);
+        buf_pos += n;
+        x += n;
+        how_much -= n;
+    }
+}
+
+uint8_t randombit(void)
+{
+    if (nbits == 0) {
+        bits = random_u64();
+        nbits = 64;
     }
+    uint8_t ret = bits & 1;
+    bits >>= 1;
+    nbits--;
+    return ret;
 }
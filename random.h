@@ -4,13 +4,49 @@
 #include <stddef.h>
 #include <stdint.h>
 
-void randombytes(uint8_t *x, size_t xlen);
+/* State of a xoshiro256** generator */
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+/* Seed generator from a single value, through SplitMix64 */
+void rng_seed(rng_t *rng, uint64_t seed);
+
+static inline uint64_t rng_rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
 
-static inline uint8_t randombit(void)
+/* Map uniform 64-bit x onto [0, m), for m below 2^32, by taking the upper
+ * 64 bits of x * m without 128-bit arithmetic.
+ */
+static inline uint64_t rng_scale(uint64_t x, uint64_t m)
 {
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
+    return ((x >> 32) * m + (((x & 0xffffffff) * m) >> 32)) >> 32;
 }
 
+/* Process-wide generator, seeded from getrandom() on first use unless
+ * random_seed() gave it a fixed seed.  A seed of 0 asks for a fresh one.
+ */
+void random_seed(uint64_t seed);
+uint64_t random_u64(void);
+
+void randombytes(uint8_t *x, size_t xlen);
+uint8_t randombit(void);
+
 #endif
@@ -0,0 +1,293 @@
+/* Compile text traces into binary form, and replay them */
+
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "report.h"
+
+#define HEADER_WORDS 6
+
+/* Growable array of 32-bit words */
+typedef struct {
+    uint32_t *data;
+    size_t cnt, size;
+} words_t;
+
+struct REPLAY_BUILDER {
+    /* String blob, and offset of each string in it */
+    char *blob;
+    size_t blob_len, blob_size;
+    words_t offsets;
+    /* Open addressing table of string IDs + 1, 0 being empty */
+    uint32_t *table;
+    size_t table_size;
+    /* String IDs of command names */
+    words_t cmds;
+    /* Encoded records */
+    uint8_t *records;
+    size_t records_len, records_size;
+    size_t nrecords;
+};
+
+static void *grow(void *p, size_t bytes)
+{
+    void *np = realloc(p, bytes);
+    if (!np)
+        report_event(MSG_FATAL, "Out of memory compiling trace");
+    return np;
+}
+
+static void push_word(words_t *w, uint32_t v)
+{
+    if (w->cnt == w->size) {
+        w->size = w->size ? 2 * w->size : 1024;
+        w->data = grow(w->data, w->size * sizeof(uint32_t));
+    }
+    w->data[w->cnt++] = v;
+}
+
+static void push_varint(replay_builder_t *b, uint32_t v)
+{
+    if (b->records_len + 5 > b->records_size) {
+        b->records_size = b->records_size ? 2 * b->records_size : 4096;
+        b->records = grow(b->records, b->records_size);
+    }
+    while (v >= 0x80) {
+        b->records[b->records_len++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    b->records[b->records_len++] = (uint8_t) v;
+}
+
+/* Decode varint at *pp, not reading at or past end.
+ * Return false when it is truncated.
+ */
+static bool pop_varint(uint8_t **pp, uint8_t *end, uint32_t *v)
+{
+    uint32_t val = 0;
+    for (int shift = 0; shift < 35 && *pp < end; shift += 7) {
+        uint8_t byte = *(*pp)++;
+        val |= (uint32_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *v = val;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t hash_string(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void rehash(replay_builder_t *b, size_t size)
+{
+    uint32_t *table = calloc(size, sizeof(uint32_t));
+    if (!table)
+        report_event(MSG_FATAL, "Out of memory compiling trace");
+    for (size_t i = 0; i < b->table_size; i++) {
+        uint32_t id = b->table[i];
+        if (!id)
+            continue;
+        size_t j = hash_string(b->blob + b->offsets.data[id - 1]) & (size - 1);
+        while (table[j])
+            j = (j + 1) & (size - 1);
+        table[j] = id;
+    }
+    free(b->table);
+    b->table = table;
+    b->table_size = size;
+}
+
+/* Return ID of string s, adding it to the table if new */
+static uint32_t intern(replay_builder_t *b, const char *s)
+{
+    if (2 * (b->offsets.cnt + 1) > b->table_size)
+        rehash(b, 2 * b->table_size);
+
+    size_t mask = b->table_size - 1;
+    size_t i = hash_string(s) & mask;
+    for (; b->table[i]; i = (i + 1) & mask) {
+        uint32_t id = b->table[i] - 1;
+        if (strcmp(b->blob + b->offsets.data[id], s) == 0)
+            return id;
+    }
+
+    size_t len = strlen(s) + 1;
+    if (b->blob_len + len > b->blob_size) {
+        while (b->blob_len + len > b->blob_size)
+            b->blob_size = b->blob_size ? 2 * b->blob_size : 4096;
+        b->blob = grow(b->blob, b->blob_size);
+    }
+    memcpy(b->blob + b->blob_len, s, len);
+    push_word(&b->offsets, (uint32_t) b->blob_len);
+    b->blob_len += len;
+    b->table[i] = (uint32_t) b->offsets.cnt;
+    return (uint32_t) b->offsets.cnt - 1;
+}
+
+replay_builder_t *replay_begin()
+{
+    replay_builder_t *b = calloc(1, sizeof(replay_builder_t));
+    if (!b)
+        report_event(MSG_FATAL, "Out of memory compiling trace");
+    rehash(b, 1024);
+    return b;
+}
+
+void replay_add(replay_builder_t *b, char *line, int argc, char *argv[])
+{
+    b->nrecords++;
+    push_varint(b, intern(b, line));
+    if (argc == 0) {
+        push_varint(b, 0);
+        return;
+    }
+
+    /* Command IDs index the command table rather than the strings */
+    uint32_t name = intern(b, argv[0]);
+    uint32_t cmd = 0;
+    while (cmd < b->cmds.cnt && b->cmds.data[cmd] != name)
+        cmd++;
+    if (cmd == b->cmds.cnt)
+        push_word(&b->cmds, name);
+
+    push_varint(b, cmd + 1);
+    push_varint(b, (uint32_t) argc);
+    for (int i = 1; i < argc; i++)
+        push_varint(b, intern(b, argv[i]));
+}
+
+static void release(replay_builder_t *b)
+{
+    free(b->blob);
+    free(b->offsets.data);
+    free(b->table);
+    free(b->cmds.data);
+    free(b->records);
+    free(b);
+}
+
+bool replay_finish(replay_builder_t *b, char *file_name)
+{
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp) {
+        release(b);
+        return false;
+    }
+
+    size_t padded = (b->blob_len + 3) & ~(size_t) 3;
+    uint32_t header[HEADER_WORDS] = {
+        REPLAY_MAGIC,
+        REPLAY_VERSION,
+        (uint32_t) b->cmds.cnt,
+        (uint32_t) b->offsets.cnt,
+        (uint32_t) b->nrecords,
+        (uint32_t) padded,
+    };
+
+    static const char zeros[4];
+    bool ok = fwrite(header, sizeof(header), 1, fp) == 1;
+    ok = ok && fwrite(b->cmds.data, sizeof(uint32_t), b->cmds.cnt, fp) ==
+                   b->cmds.cnt;
+    ok = ok && fwrite(b->offsets.data, sizeof(uint32_t), b->offsets.cnt,
+                      fp) == b->offsets.cnt;
+    ok = ok && fwrite(b->blob, 1, b->blob_len, fp) == b->blob_len;
+    ok = ok && fwrite(zeros, 1, padded - b->blob_len, fp) ==
+                   padded - b->blob_len;
+    ok = ok && fwrite(b->records, 1, b->records_len, fp) == b->records_len;
+    ok = (fclose(fp) == 0) && ok;
+
+    release(b);
+    return ok;
+}
+
+void replay_abort(replay_builder_t *b)
+{
+    release(b);
+}
+
+bool replay_is_compiled(char *map, size_t len)
+{
+    return len >= HEADER_WORDS * sizeof(uint32_t) &&
+           ((uint32_t *) map)[0] == REPLAY_MAGIC;
+}
+
+bool replay_open(replay_t *rp, char *map, size_t len)
+{
+    uint32_t *header = (uint32_t *) map;
+    if (!replay_is_compiled(map, len) || header[1] != REPLAY_VERSION)
+        return false;
+
+    size_t words = len / sizeof(uint32_t);
+    size_t ncmds = header[2], nstrings = header[3], blob_words = header[5] / 4;
+    if (header[5] % 4 || HEADER_WORDS + ncmds + nstrings + blob_words > words)
+        return false;
+
+    rp->ncmds = (uint32_t) ncmds;
+    rp->cmds = header + HEADER_WORDS;
+    rp->nstrings = (uint32_t) nstrings;
+    rp->offsets = rp->cmds + ncmds;
+    rp->blob = (char *) (rp->offsets + nstrings);
+    rp->rec = (uint8_t *) (rp->offsets + nstrings + blob_words);
+    rp->rec_end = (uint8_t *) map + len;
+
+    /* Every string must lie within the blob, and be terminated there */
+    if (header[5] && rp->blob[header[5] - 1] != '\0')
+        return false;
+    for (size_t i = 0; i < nstrings; i++) {
+        if (rp->offsets[i] >= header[5])
+            return false;
+    }
+    for (size_t i = 0; i < ncmds; i++) {
+        if (rp->cmds[i] >= nstrings)
+            return false;
+    }
+    return true;
+}
+
+char *replay_cmd_name(replay_t *rp, uint32_t cmd)
+{
+    return rp->blob + rp->offsets[rp->cmds[cmd]];
+}
+
+bool replay_next(replay_t *rp,
+                 char **line,
+                 uint32_t *cmd,
+                 int *argcp,
+                 char *argv[],
+                 int maxargs)
+{
+    uint8_t *rec = rp->rec;
+    uint32_t line_id, cmd_id, argc = 0;
+    if (!pop_varint(&rec, rp->rec_end, &line_id) ||
+        !pop_varint(&rec, rp->rec_end, &cmd_id) || line_id >= rp->nstrings ||
+        cmd_id > rp->ncmds)
+        return false;
+    if (cmd_id && (!pop_varint(&rec, rp->rec_end, &argc) || argc == 0 ||
+                   argc > (uint32_t) maxargs))
+        return false;
+
+    *line = rp->blob + rp->offsets[line_id];
+    *cmd = cmd_id ? cmd_id - 1 : REPLAY_NOCMD;
+    *argcp = (int) argc;
+    if (argc)
+        argv[0] = replay_cmd_name(rp, cmd_id - 1);
+    for (uint32_t i = 1; i < argc; i++) {
+        uint32_t id;
+        if (!pop_varint(&rec, rp->rec_end, &id) || id >= rp->nstrings)
+            return false;
+        argv[i] = rp->blob + rp->offsets[id];
+    }
+    rp->rec = rec;
+    return true;
+}
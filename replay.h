@@ -0,0 +1,79 @@
+#ifndef LAB0_REPLAY_H
+#define LAB0_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Compiled trace files.
+ *
+ * A trace is compiled once into a binary file holding an interned string
+ * table and one record per line: the command ID, and the string IDs of the
+ * original line (for echoing) and of each argument.  Replaying it skips
+ * reading, splitting and looking up each line of text.
+ *
+ * Layout, all fields but the records being native uint32_t:
+ *   header    magic, version, ncmds, nstrings, nrecords, blob_size
+ *   commands  ncmds string IDs of command names
+ *   offsets   nstrings offsets into blob
+ *   blob      null-terminated strings, padded to multiple of 4 bytes
+ *   records   line ID, command ID + 1 (0 for no command), and when there
+ *             is a command, argc followed by argc - 1 argument IDs.
+ *             Each is stored as LEB128 varint, taking one byte for
+ *             values below 128.
+ */
+
+#define REPLAY_MAGIC 0x43525451 /* "QTRC" */
+#define REPLAY_VERSION 2
+
+/* Command ID of lines holding no command */
+#define REPLAY_NOCMD UINT32_MAX
+
+/* Compiled trace being built */
+typedef struct REPLAY_BUILDER replay_builder_t;
+
+/* Start building compiled trace */
+replay_builder_t *replay_begin();
+
+/* Add line, already split into argc words in argv */
+void replay_add(replay_builder_t *b, char *line, int argc, char *argv[]);
+
+/* Write compiled trace to file and release builder.
+ * Return true if successful.
+ */
+bool replay_finish(replay_builder_t *b, char *file_name);
+
+/* Release builder without writing anything */
+void replay_abort(replay_builder_t *b);
+
+/* Compiled trace being replayed, reading from mapped file */
+typedef struct {
+    char *blob;
+    uint32_t *offsets;
+    uint32_t nstrings;
+    uint32_t *cmds;
+    uint32_t ncmds;
+    uint8_t *rec;
+    uint8_t *rec_end;
+} replay_t;
+
+/* Does mapped file hold compiled trace? */
+bool replay_is_compiled(char *map, size_t len);
+
+/* Prepare for replay of mapped file.  Return false if it is malformed */
+bool replay_open(replay_t *rp, char *map, size_t len);
+
+/* Name of command with given ID */
+char *replay_cmd_name(replay_t *rp, uint32_t cmd);
+
+/* Get next line of trace.  argv[0] is set to the command name.
+ * Return false at end of trace, or when the record is malformed.
+ */
+bool replay_next(replay_t *rp,
+                 char **line,
+                 uint32_t *cmd,
+                 int *argcp,
+                 char *argv[],
+                 int maxargs);
+
+#endif /* LAB0_REPLAY_H */
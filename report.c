@@ -17,11 +17,21 @@ static FILE *errfile = NULL;
 static FILE *verbfile = NULL;
 static FILE *logfile = NULL;
 
+/* Output to a terminal is flushed line by line, so that it shows up at
+ * once.  Output to files and pipes stays in stdio buffers until they fill
+ * up or report_flush is called.
+ */
+static bool verb_tty = false;
+
+/* Buffer size of log file */
+#define LOG_BUFSIZE (64 * 1024)
+
 int verblevel = 0;
 static void init_files(FILE *efile, FILE *vfile)
 {
     errfile = efile;
     verbfile = vfile;
+    verb_tty = isatty(fileno(vfile));
 }
 
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
@@ -47,6 +57,8 @@ void set_verblevel(int level)
 bool set_logfile(char *file_name)
 {
     logfile = fopen(file_name, "w");
+    if (logfile)
+        setvbuf(logfile, NULL, _IOFBF, LOG_BUFSIZE);
     return logfile != NULL;
 }
 
@@ -78,12 +90,11 @@ void report_event(message_t msg, char *fmt, ...)
         fprintf(logfile, "Error: ");
         vfprintf(logfile, fmt, ap);
         fprintf(logfile, "\n");
-        fflush(logfile);
         va_end(ap);
-        fclose(logfile);
     }
 
     if (fatal) {
+        report_flush();
         if (fatal_fun)
             fatal_fun();
         exit(1);
@@ -100,14 +111,14 @@ void report(int level, char *fmt, ...)
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
         fprintf(verbfile, "\n");
-        fflush(verbfile);
+        if (verb_tty)
+            fflush(verbfile);
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
             vfprintf(logfile, fmt, ap);
             fprintf(logfile, "\n");
-            fflush(logfile);
             va_end(ap);
         }
     }
@@ -122,18 +133,26 @@ void report_noreturn(int level, char *fmt, ...)
         va_list ap;
         va_start(ap, fmt);
         vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
+        if (verb_tty)
+            fflush(verbfile);
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
             vfprintf(logfile, fmt, ap);
-            fflush(logfile);
             va_end(ap);
         }
     }
 }
 
+void report_flush()
+{
+    if (verbfile)
+        fflush(verbfile);
+    if (logfile)
+        fflush(logfile);
+}
+
 /* Functions denoting failures */
 
 /* Need to be able to print without using malloc */
@@ -142,7 +161,8 @@ static void fail_fun(char *format, char *msg)
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
-    /* Use write to avoid any buffering issues */
+    /* Use write to avoid any buffering issues, after what is buffered */
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
 
     if (logfile) {
@@ -282,9 +302,9 @@ void init_time(double *timep)
 
 double delta_time(double *timep)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    double current_time = tv.tv_sec + 1.0E-6 * tv.tv_usec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double current_time = ts.tv_sec + 1.0E-9 * ts.tv_nsec;
     double delta = current_time - *timep;
     *timep = current_time;
     return delta;
@@ -26,6 +26,11 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Write out buffered output.  Call before output bypasses stdio, and
+ * before waiting for input.
+ */
+void report_flush();
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, char *fun_name);
 
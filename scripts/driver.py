@@ -35,7 +35,15 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-save-load",
+        19: "trace-19-stats",
+        20: "trace-20-compile-replay",
+        21: "trace-21-repeat-loop",
+        22: "trace-22-bench",
+        23: "trace-23-complexity-cmd",
+        24: "trace-24-event-trace",
+        25: "trace-25-perf"
     }
 
     traceProbs = {
@@ -55,10 +63,18 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24",
+        25: "Trace-25"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5, 5, 5, 5, 5, 5, 5, 5, 5]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+
+# Convert event trace written by qtest 'trace' command into Chrome trace
+# JSON, which chrome://tracing and https://ui.perfetto.dev can open.
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x56455451
+TRACE_VERSION = 1
+TRACE_FAILED = 1
+
+HEADER = struct.Struct("=IIIIQQ")
+EVENT = struct.Struct("=QQqIHH")
+
+
+def read_trace(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        raise ValueError("file too short")
+    magic, version, ncmds, blob_size, nevents, dropped = \
+        HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC or version != TRACE_VERSION:
+        raise ValueError("not a qtest event trace")
+
+    pos = HEADER.size
+    names = data[pos:pos + blob_size].split(b"\0")[:ncmds]
+    names = [n.decode(errors="replace") for n in names]
+    pos += blob_size
+    if len(data) < pos + nevents * EVENT.size:
+        raise ValueError("file truncated")
+
+    events = [EVENT.unpack_from(data, pos + i * EVENT.size)
+              for i in range(nevents)]
+    return names, events, dropped
+
+
+def convert(names, events):
+    out = []
+    base = min((e[0] for e in events), default=0)
+    for start, dur, alloc_delta, size, cmd, flags in events:
+        ts = (start - base) / 1000.0
+        name = names[cmd] if cmd < len(names) else "cmd%d" % cmd
+        out.append({
+            "name": name,
+            "ph": "X",
+            "ts": ts,
+            "dur": dur / 1000.0,
+            "pid": 1,
+            "tid": 1,
+            "args": {
+                "size": size,
+                "alloc_delta": alloc_delta,
+                "ok": not flags & TRACE_FAILED,
+            },
+        })
+        out.append({
+            "name": "queue size",
+            "ph": "C",
+            "ts": (start - base + dur) / 1000.0,
+            "pid": 1,
+            "args": {"size": size},
+        })
+    return {"traceEvents": out, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Convert qtest event trace to Chrome trace JSON")
+    parser.add_argument("trace", help="file written by qtest 'trace'")
+    parser.add_argument("-o", "--output",
+                        help="JSON file to write (default: stdout)")
+    args = parser.parse_args()
+
+    try:
+        names, events, dropped = read_trace(args.trace)
+    except (OSError, ValueError) as e:
+        print("%s: %s" % (args.trace, e), file=sys.stderr)
+        return 1
+    if dropped:
+        print("%d oldest events were overwritten" % dropped, file=sys.stderr)
+
+    result = convert(names, events)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(result, f)
+    else:
+        json.dump(result, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,122 @@
+/* Queue files written by save and read by load */
+
+#include "snapshot.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "queue.h"
+
+#define HEADER_BYTES (2 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+
+bool snapshot_save(char *file_name, struct list_head *head)
+{
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp)
+        return false;
+
+    /* Sizes first, so that offsets can be written before the strings */
+    uint64_t count = 0, blob_size = 0;
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        count++;
+        blob_size += strlen(e->value) + 1;
+    }
+
+    uint32_t header32[2] = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION};
+    uint64_t header64[2] = {count, blob_size};
+    bool ok = fwrite(header32, sizeof(header32), 1, fp) == 1;
+    ok = ok && fwrite(header64, sizeof(header64), 1, fp) == 1;
+
+    uint64_t offset = 0;
+    list_for_each_entry (e, head, list) {
+        if (!ok)
+            break;
+        ok = fwrite(&offset, sizeof(offset), 1, fp) == 1;
+        offset += strlen(e->value) + 1;
+    }
+    list_for_each_entry (e, head, list) {
+        if (!ok)
+            break;
+        ok = fputs(e->value, fp) >= 0 && fputc('\0', fp) == '\0';
+    }
+    ok = (fclose(fp) == 0) && ok;
+    return ok;
+}
+
+/* Are offsets ascending, and is each string terminated before the next? */
+static bool valid_strings(const snapshot_t *s)
+{
+    if (s->count == 0)
+        return s->blob_size == 0;
+    if (s->blob_size == 0 || s->offsets[0] != 0 ||
+        s->blob[s->blob_size - 1] != '\0')
+        return false;
+    for (uint64_t i = 1; i < s->count; i++) {
+        uint64_t off = s->offsets[i];
+        if (off <= s->offsets[i - 1] || off >= s->blob_size ||
+            s->blob[off - 1] != '\0')
+            return false;
+    }
+    return true;
+}
+
+bool snapshot_open(snapshot_t *s, char *file_name)
+{
+    memset(s, 0, sizeof(*s));
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+    /* Private, so that strings used in place can be written to */
+    void *map =
+        mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    s->map = map;
+    s->map_len = st.st_size;
+
+    const uint32_t *header32 = map;
+    const uint64_t *header64 = (const uint64_t *) (header32 + 2);
+    s->count = header64[0];
+    s->blob_size = header64[1];
+    size_t room = s->map_len - HEADER_BYTES;
+    if (header32[0] != SNAPSHOT_MAGIC || header32[1] != SNAPSHOT_VERSION ||
+        s->count > room / sizeof(uint64_t) ||
+        s->blob_size != room - s->count * sizeof(uint64_t)) {
+        snapshot_close(s);
+        return false;
+    }
+    s->offsets = header64 + 2;
+    s->blob = (const char *) (s->offsets + s->count);
+
+    /* Sequential pass over the strings, worth announcing to the kernel */
+    madvise(s->map, s->map_len, MADV_SEQUENTIAL);
+    if (!valid_strings(s)) {
+        snapshot_close(s);
+        return false;
+    }
+    return true;
+}
+
+void snapshot_close(snapshot_t *s)
+{
+    if (s->map)
+        munmap(s->map, s->map_len);
+    memset(s, 0, sizeof(*s));
+}
+
+void snapshot_unmap(void *map, size_t len)
+{
+    munmap(map, len);
+}
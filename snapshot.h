@@ -0,0 +1,57 @@
+#ifndef LAB0_SNAPSHOT_H
+#define LAB0_SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "list.h"
+
+/* Queue files, written by the save command and read back by load.
+ *
+ * The file is mapped when loaded, and strings are used where they lie in
+ * the mapping: copied in one pass, or pointed to directly.
+ *
+ * Layout, all fields native:
+ *   header    magic, version (uint32_t), count, blob_size (uint64_t)
+ *   offsets   count uint64_t offsets of the strings into blob
+ *   blob      count null-terminated strings, in queue order
+ */
+
+#define SNAPSHOT_MAGIC 0x45555451 /* "QTQE" */
+#define SNAPSHOT_VERSION 1
+
+/* Write strings of queue to file.  Return true if successful */
+bool snapshot_save(char *file_name, struct list_head *head);
+
+/* Queue file being loaded, mapped copy-on-write: writes to the strings
+ * never reach the file
+ */
+typedef struct {
+    char *map;
+    size_t map_len;
+    uint64_t count;
+    const uint64_t *offsets;
+    const char *blob;
+    uint64_t blob_size;
+} snapshot_t;
+
+/* Map and validate queue file.  Return false if it cannot be read or is
+ * malformed, with s left closed.
+ */
+bool snapshot_open(snapshot_t *s, char *file_name);
+
+/* Unmap queue file */
+void snapshot_close(snapshot_t *s);
+
+/* Unmap mapping of queue file taken over from snapshot_t */
+void snapshot_unmap(void *map, size_t len);
+
+/* Length of string i, without its null character */
+static inline size_t snapshot_len(const snapshot_t *s, uint64_t i)
+{
+    uint64_t end = i + 1 < s->count ? s->offsets[i + 1] : s->blob_size;
+    return end - s->offsets[i] - 1;
+}
+
+#endif /* LAB0_SNAPSHOT_H */
@@ -0,0 +1,132 @@
+/* Event tracing of console commands */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "report.h"
+
+#define TRACE_MAX_CMDS 1024
+
+bool trace_active = false;
+
+static char *cmd_names[TRACE_MAX_CMDS];
+static uint16_t ncmds = 0;
+
+static trace_probe_t probe_size = NULL;
+static trace_probe_t probe_allocs = NULL;
+
+/* Ring of capacity mask + 1 events, a power of two.  head counts every
+ * event ever recorded, so the slot of the next one is head & mask.
+ */
+static trace_event_t *ring = NULL;
+static size_t mask = 0;
+static uint64_t head = 0;
+
+void trace_set_probes(trace_probe_t size, trace_probe_t allocs)
+{
+    probe_size = size;
+    probe_allocs = allocs;
+}
+
+uint16_t trace_cmd_id(char *name)
+{
+    if (ncmds == TRACE_MAX_CMDS) {
+        report(1, "Too many commands to trace, '%s' traced as '%s'", name,
+               cmd_names[ncmds - 1]);
+        return ncmds - 1;
+    }
+    cmd_names[ncmds] = name;
+    return ncmds++;
+}
+
+void trace_start(size_t nevents)
+{
+    size_t cap = 1;
+    while (cap < nevents)
+        cap <<= 1;
+    if (!ring || cap != mask + 1) {
+        trace_free();
+        ring = calloc_or_fail(cap, sizeof(trace_event_t), "trace_start");
+        mask = cap - 1;
+    }
+    trace_active = true;
+}
+
+void trace_stop()
+{
+    trace_active = false;
+}
+
+void trace_begin(uint64_t *allocs)
+{
+    *allocs = probe_allocs ? probe_allocs() : 0;
+}
+
+void trace_record(uint16_t cmd,
+                  uint64_t start_ns,
+                  uint64_t end_ns,
+                  uint64_t allocs,
+                  bool ok)
+{
+    /* Command may have stopped tracing or released the ring */
+    if (!ring)
+        return;
+
+    trace_event_t *e = &ring[head & mask];
+    e->start_ns = start_ns;
+    e->dur_ns = end_ns - start_ns;
+    e->alloc_delta = probe_allocs ? (int64_t) (probe_allocs() - allocs) : 0;
+    e->size = probe_size ? (uint32_t) probe_size() : 0;
+    e->cmd = cmd;
+    e->flags = ok ? 0 : TRACE_FAILED;
+    head++;
+}
+
+bool trace_dump(char *file_name)
+{
+    FILE *fp = fopen(file_name, "wb");
+    if (!fp)
+        return false;
+
+    size_t blob_len = 0;
+    for (uint16_t i = 0; i < ncmds; i++)
+        blob_len += strlen(cmd_names[i]) + 1;
+    size_t padded = (blob_len + 7) & ~(size_t) 7;
+
+    uint64_t cap = ring ? mask + 1 : 0;
+    uint64_t nevents = head < cap ? head : cap;
+    uint32_t header32[4] = {TRACE_MAGIC, TRACE_VERSION, ncmds,
+                            (uint32_t) padded};
+    uint64_t header64[2] = {nevents, head - nevents};
+
+    static const char zeros[8];
+    bool ok = fwrite(header32, sizeof(header32), 1, fp) == 1;
+    ok = ok && fwrite(header64, sizeof(header64), 1, fp) == 1;
+    for (uint16_t i = 0; ok && i < ncmds; i++)
+        ok = fwrite(cmd_names[i], strlen(cmd_names[i]) + 1, 1, fp) == 1;
+    ok = ok && fwrite(zeros, 1, padded - blob_len, fp) == padded - blob_len;
+
+    /* Oldest event is at head once the ring has wrapped around */
+    if (nevents) {
+        size_t first = (head - nevents) & mask;
+        size_t part = cap - first < nevents ? cap - first : nevents;
+        ok = ok &&
+             fwrite(ring + first, sizeof(trace_event_t), part, fp) == part;
+        ok = ok && fwrite(ring, sizeof(trace_event_t), nevents - part, fp) ==
+                       nevents - part;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    return ok;
+}
+
+void trace_free()
+{
+    if (ring)
+        free_array(ring, mask + 1, sizeof(trace_event_t));
+    ring = NULL;
+    mask = 0;
+    head = 0;
+    trace_active = false;
+}
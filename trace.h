@@ -0,0 +1,77 @@
+#ifndef LAB0_TRACE_H
+#define LAB0_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Event tracing of console commands.
+ *
+ * Each executed command is recorded as a fixed-size event in a ring
+ * buffer, overwriting the oldest events once it is full.  Recording takes
+ * no locks and no system calls beyond reading the clock, so tracing can be
+ * left on across long sessions and dumped when something looks wrong.
+ *
+ * Layout of dumped files, all fields native:
+ *   header    magic, version, ncmds, blob_size (uint32_t),
+ *             nevents, dropped (uint64_t)
+ *   blob      ncmds null-terminated command names, padded to multiple
+ *             of 8 bytes.  Command ID i is the i-th name
+ *   events    nevents trace_event_t, oldest first
+ */
+
+#define TRACE_MAGIC 0x56455451 /* "QTEV" */
+#define TRACE_VERSION 1
+
+/* Events kept by default */
+#define TRACE_EVENTS 65536
+
+/* Command returned false */
+#define TRACE_FAILED 1
+
+typedef struct {
+    uint64_t start_ns; /* Monotonic clock at start of command */
+    uint64_t dur_ns;
+    int64_t alloc_delta; /* Change in number of allocated blocks */
+    uint32_t size;       /* Queue size after command */
+    uint16_t cmd;        /* Command ID */
+    uint16_t flags;
+} trace_event_t;
+
+/* Sampled values, supplied by the program */
+typedef size_t (*trace_probe_t)(void);
+
+/* Is recording on? */
+extern bool trace_active;
+
+/* Set functions giving queue size and number of allocated blocks */
+void trace_set_probes(trace_probe_t size, trace_probe_t allocs);
+
+/* Assign command ID to name, which must outlive tracing */
+uint16_t trace_cmd_id(char *name);
+
+/* Start recording into ring of at least nevents events.
+ * Recorded events are kept when the capacity does not change.
+ */
+void trace_start(size_t nevents);
+
+/* Stop recording.  Recorded events are kept for dumping */
+void trace_stop();
+
+/* Sample probes before command */
+void trace_begin(uint64_t *allocs);
+
+/* Record command that started at start_ns, with allocs from trace_begin */
+void trace_record(uint16_t cmd,
+                  uint64_t start_ns,
+                  uint64_t end_ns,
+                  uint64_t allocs,
+                  bool ok);
+
+/* Write recorded events to file.  Return true if successful */
+bool trace_dump(char *file_name);
+
+/* Release ring buffer */
+void trace_free();
+
+#endif /* LAB0_TRACE_H */
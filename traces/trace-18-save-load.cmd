@@ -0,0 +1,22 @@
+# Test of save and load, with strings copied and used in place
+option fail 0
+option malloc 0
+new
+ih gerbil
+it jaguar
+it meerkat
+save /tmp/qtest-trace-18.bin
+load /tmp/qtest-trace-18.bin
+load /tmp/qtest-trace-18.bin zerocopy
+rh gerbil
+rh jaguar
+rh meerkat
+rt meerkat
+reverse
+rh jaguar
+free
+new
+load /tmp/qtest-trace-18.bin zerocopy
+sort
+rh gerbil
+free
@@ -0,0 +1,11 @@
+# Test of latency statistics of commands
+option fail 0
+option malloc 0
+new
+ih dolphin
+it gerbil
+ih bear 10
+rh bear
+stats
+stats /tmp/qtest-trace-19.json
+free
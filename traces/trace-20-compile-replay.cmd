@@ -0,0 +1,10 @@
+# Test of compiling a trace and replaying it
+option fail 0
+option malloc 0
+compile traces/trace-01-ops.cmd /tmp/qtest-trace-20.bin
+source /tmp/qtest-trace-20.bin
+new
+ih gerbil
+compile traces/trace-02-ops.cmd /tmp/qtest-trace-20.bin
+free
+source /tmp/qtest-trace-20.bin
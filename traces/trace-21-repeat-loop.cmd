@@ -0,0 +1,21 @@
+# Test of repeat and loop
+option fail 0
+option malloc 0
+new
+repeat 3 ih gerbil
+loop 2
+it dolphin
+ih bear
+end
+rh bear
+rh bear
+repeat 3 rh gerbil
+rh dolphin
+rh dolphin
+loop 2
+repeat 2 it jaguar
+rh jaguar
+end
+rh jaguar
+rh jaguar
+free
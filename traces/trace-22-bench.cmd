@@ -0,0 +1,18 @@
+# Test of bench, which leaves the queue being tested as it is
+option fail 0
+option malloc 0
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+bench ih 100
+bench rh 100 5
+bench reverse 50 0
+bench sort 50
+bench dedup 20
+rh dolphin
+rh bear
+rh gerbil
+rh meerkat
+free
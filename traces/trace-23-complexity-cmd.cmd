@@ -0,0 +1,10 @@
+# Test of complexity, which builds its own queues
+option fail 0
+option malloc 0
+new
+ih gerbil
+complexity it 512
+complexity rh 512
+complexity reverse 512
+rh gerbil
+free
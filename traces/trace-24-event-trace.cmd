@@ -0,0 +1,14 @@
+# Test of event tracing of commands
+option fail 0
+option malloc 0
+trace on 16 /tmp/qtest-trace-24.bin
+new
+ih gerbil 20
+it dolphin
+reverse
+trace dump /tmp/qtest-trace-24.bin
+rh dolphin
+trace off
+trace on 4
+rh gerbil
+free
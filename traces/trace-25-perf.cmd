@@ -0,0 +1,11 @@
+# Test of performance counters, whether or not the system offers them
+option fail 0
+option malloc 0
+new
+perf ih gerbil 10
+option perf 1
+it dolphin
+reverse
+option perf 0
+rh dolphin
+free
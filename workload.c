@@ -0,0 +1,272 @@
+#include "workload.h"
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "report.h"
+
+#define DEFAULT_ALPHABET "abcdefghijklmnopqrstuvwxyz"
+
+/* Accurate log1p(x) / x and expm1(x) / x near 0 */
+static double helper1(double x)
+{
+    return fabs(x) > 1e-8 ? log1p(x) / x
+                          : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double helper2(double x)
+{
+    return fabs(x) > 1e-8 ? expm1(x) / x
+                          : 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+/* Density h(x) = x^-s, its integral H and the inverse of H, as used by
+ * the rejection-inversion method of Hoermann and Derflinger.
+ */
+static double zipf_h(const workload_t *w, double x)
+{
+    return exp(-w->s * log(x));
+}
+
+static double zipf_hint(const workload_t *w, double x)
+{
+    double log_x = log(x);
+    return helper2((1 - w->s) * log_x) * log_x;
+}
+
+static double zipf_hinv(const workload_t *w, double x)
+{
+    double t = x * (1 - w->s);
+    if (t < -1)
+        t = -1;
+    return exp(helper1(t) * x);
+}
+
+static void zipf_init(workload_t *w)
+{
+    w->h_x1 = zipf_hint(w, 1.5) - 1;
+    w->h_n = zipf_hint(w, w->keys + 0.5);
+    w->s_factor = 2 - zipf_hinv(w, zipf_hint(w, 2.5) - zipf_h(w, 2));
+}
+
+/* Draw rank in 1..keys, in constant expected time for any keys */
+static size_t zipf_next(workload_t *w)
+{
+    for (;;) {
+        double v = (rng_next(&w->rng) >> 11) * 0x1.0p-53;
+        double u = w->h_n + v * (w->h_x1 - w->h_n);
+        double x = zipf_hinv(w, u);
+        double k = floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > w->keys)
+            k = w->keys;
+        if (k - x <= w->s_factor ||
+            u >= zipf_hint(w, k + 0.5) - zipf_h(w, k))
+            return (size_t) k;
+    }
+}
+
+static bool parse_u64(char *s, uint64_t *v)
+{
+    char *end;
+    errno = 0;
+    unsigned long long x = strtoull(s, &end, 0);
+    if (errno || end == s || *end || *s == '-')
+        return false;
+    *v = x;
+    return true;
+}
+
+static bool parse_size(char *s, size_t *v)
+{
+    uint64_t x;
+    if (!parse_u64(s, &x) || x > SIZE_MAX)
+        return false;
+    *v = x;
+    return true;
+}
+
+static bool parse_option(workload_t *w, char *opt)
+{
+    char *val = strchr(opt, '=');
+    if (!val)
+        return false;
+    *val++ = '\0';
+
+    if (!strcmp(opt, "dist")) {
+        char *arg = strchr(val, ':');
+        if (arg)
+            *arg++ = '\0';
+        if (!strcmp(val, "uniform") && !arg) {
+            w->dist = WL_UNIFORM;
+        } else if (!strcmp(val, "zipf")) {
+            char *end;
+            w->dist = WL_ZIPF;
+            w->s = arg ? strtod(arg, &end) : 1.0;
+            return w->s > 0 && (!arg || !*end);
+        } else if (!strcmp(val, "sorted") && !arg) {
+            w->dist = WL_SORTED;
+        } else if (!strcmp(val, "reversed") && !arg) {
+            w->dist = WL_REVERSED;
+        } else if (!strcmp(val, "dups") && arg) {
+            w->dist = WL_DUPS;
+            /* Keys are drawn with rng_scale, which needs fewer than 2^32 */
+            return parse_size(arg, &w->keys) && w->keys > 0 &&
+                   w->keys <= UINT32_MAX;
+        } else {
+            return false;
+        }
+        return true;
+    }
+    if (!strcmp(opt, "len")) {
+        char *max = strchr(val, ':');
+        if (max)
+            *max++ = '\0';
+        return parse_size(val, &w->min_len) &&
+               parse_size(max ? max : val, &w->max_len) && w->min_len > 0 &&
+               w->min_len <= w->max_len;
+    }
+    if (!strcmp(opt, "alphabet")) {
+        bool seen[256] = {false};
+        for (unsigned char *c = (unsigned char *) val; *c; c++)
+            seen[*c] = true;
+        w->nalpha = 0;
+        for (int c = 1; c < 256; c++) {
+            if (seen[c])
+                w->alphabet[w->nalpha++] = c;
+        }
+        return w->nalpha > 0;
+    }
+    if (!strcmp(opt, "seed"))
+        return parse_u64(val, &w->seed);
+    return false;
+}
+
+bool workload_init(workload_t *w,
+                   size_t count,
+                   size_t min_len,
+                   size_t max_len,
+                   size_t buf_size,
+                   int argc,
+                   char *argv[])
+{
+    memset(w, 0, sizeof(*w));
+    w->dist = WL_UNIFORM;
+    w->count = count;
+    w->keys = count > 0 ? count : 1;
+    w->min_len = min_len;
+    w->max_len = max_len;
+    w->nalpha = strlen(DEFAULT_ALPHABET);
+    memcpy(w->alphabet, DEFAULT_ALPHABET, w->nalpha);
+    w->seed = random_u64();
+
+    /* Options are parsed in place, from a copy */
+    for (int i = 0; i < argc; i++) {
+        char opt[512];
+        bool ok = strlen(argv[i]) < sizeof(opt);
+        if (ok) {
+            strcpy(opt, argv[i]);
+            ok = parse_option(w, opt);
+        }
+        if (!ok) {
+            report(1, "Invalid workload option '%s'", argv[i]);
+            return false;
+        }
+    }
+
+    /* Default lengths are only checked here, as a pair.  The bound on
+     * max_len also keeps the span of lengths in reach of rng_scale.
+     */
+    if (w->min_len == 0 || w->min_len > w->max_len ||
+        w->max_len >= buf_size) {
+        report(1, "String lengths must satisfy 1 <= min <= max < %zu",
+               buf_size);
+        return false;
+    }
+
+    /* Index prefix needs enough digits for count - 1 */
+    if (w->dist == WL_SORTED || w->dist == WL_REVERSED) {
+        if (w->nalpha < 2) {
+            report(1, "Sorted strings need at least 2 characters in alphabet");
+            return false;
+        }
+        w->width = 1;
+        for (uint64_t n = w->nalpha; n < w->count; n *= w->nalpha)
+            w->width++;
+    }
+    if (w->dist == WL_ZIPF)
+        zipf_init(w);
+    rng_seed(&w->rng, w->seed);
+    return true;
+}
+
+/* Fill buf[from..len) with random characters drawn from rng */
+static void fill_chars(const workload_t *w,
+                       rng_t *rng,
+                       char *buf,
+                       size_t from,
+                       size_t len)
+{
+    for (size_t n = from; n < len; n += 8) {
+        uint64_t r = rng_next(rng);
+        size_t end = n + 8 < len ? n + 8 : len;
+        for (size_t i = n; i < end; i++) {
+            buf[i] = w->alphabet[rng_scale(r, w->nalpha)];
+            r *= w->nalpha;
+        }
+    }
+}
+
+static size_t draw_len(const workload_t *w, rng_t *rng, size_t buf_size)
+{
+    size_t len =
+        w->min_len + rng_scale(rng_next(rng), w->max_len - w->min_len + 1);
+    return len < buf_size ? len : buf_size - 1;
+}
+
+/* Key of given rank, the same whenever the rank comes up again */
+static void make_key(const workload_t *w,
+                     uint64_t rank,
+                     char *buf,
+                     size_t buf_size)
+{
+    rng_t rng;
+    rng_seed(&rng, w->seed ^ (rank * 0x9e3779b97f4a7c15ULL));
+    size_t len = draw_len(w, &rng, buf_size);
+    fill_chars(w, &rng, buf, 0, len);
+    buf[len] = '\0';
+}
+
+void workload_next(workload_t *w, char *buf, size_t buf_size)
+{
+    size_t i = w->index++;
+    switch (w->dist) {
+    case WL_ZIPF:
+        make_key(w, zipf_next(w), buf, buf_size);
+        break;
+    case WL_DUPS:
+        make_key(w, rng_scale(rng_next(&w->rng), w->keys), buf, buf_size);
+        break;
+    case WL_SORTED:
+    case WL_REVERSED: {
+        uint64_t k = w->dist == WL_SORTED ? i : w->count - 1 - i;
+        size_t len = draw_len(w, &w->rng, buf_size);
+        if (len < w->width)
+            len = w->width < buf_size ? w->width : buf_size - 1;
+        for (size_t d = w->width; d-- > 0;) {
+            if (d < len)
+                buf[d] = w->alphabet[k % w->nalpha];
+            k /= w->nalpha;
+        }
+        fill_chars(w, &w->rng, buf, w->width < len ? w->width : len, len);
+        buf[len] = '\0';
+        break;
+    }
+    default: {
+        size_t len = draw_len(w, &w->rng, buf_size);
+        fill_chars(w, &w->rng, buf, 0, len);
+        buf[len] = '\0';
+    }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef LAB0_WORKLOAD_H
+#define LAB0_WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "random.h"
+
+/* Generators of string workloads for ih/it RAND.
+ *
+ * Strings are produced one at a time from a small state, never kept in
+ * memory, so workloads of any size can be streamed into the queue.  Keys
+ * of the zipf and dups distributions are derived from their rank and the
+ * seed, and sorted or reversed keys start with their index written in
+ * the alphabet, so the same options and seed give the same strings.
+ */
+
+enum {
+    WL_UNIFORM,  /* Independent random strings */
+    WL_ZIPF,     /* Keys ranked 1..n, drawn with probability ~ 1/rank^s */
+    WL_SORTED,   /* Strictly ascending strings */
+    WL_REVERSED, /* Strictly descending strings */
+    WL_DUPS,     /* Uniform draws among K distinct keys */
+};
+
+typedef struct {
+    int dist;
+    size_t count;   /* Number of strings to generate */
+    size_t index;   /* Number generated so far */
+    size_t keys;    /* Distinct keys of zipf and dups */
+    size_t min_len, max_len;
+    char alphabet[256]; /* Sorted characters, no duplicates */
+    size_t nalpha;
+    size_t width; /* Length of index prefix of sorted strings */
+    uint64_t seed;
+    rng_t rng;
+    /* Constants of rejection-inversion sampling for zipf */
+    double s, h_x1, h_n, s_factor;
+} workload_t;
+
+/* Set up w for count strings from options such as dist=zipf:1.1,
+ * len=5:9, alphabet=abc and seed=42, to be written into buffers of
+ * buf_size bytes.  Lengths are min_len to max_len unless len= is given.
+ * Report and return false on errors.
+ */
+bool workload_init(workload_t *w,
+                   size_t count,
+                   size_t min_len,
+                   size_t max_len,
+                   size_t buf_size,
+                   int argc,
+                   char *argv[]);
+
+/* Write next string into buf, truncated to buf_size - 1 characters */
+void workload_next(workload_t *w, char *buf, size_t buf_size);
+
+#endif